@@ -483,6 +483,9 @@ static void fm_app_config_init(FmAppConfig *cfg)
     fm_config_load_from_file((FmConfig*)cfg, NULL);
 
     cfg->bm_open_method = FM_OPEN_IN_CURRENT_TAB;
+    cfg->wallpaper_cache_size = 128;
+    cfg->wallpaper_disk_cache_size = 128;
+    cfg->trash_update_interval = 500;
 
     cfg->mount_on_startup = TRUE;
     cfg->mount_removable = TRUE;
@@ -516,6 +519,7 @@ static void fm_app_config_init(FmAppConfig *cfg)
     cfg->desktop_section.desktop_sort_by = COL_FILE_MTIME;
 #endif
     cfg->desktop_section.wallpaper_common = TRUE;
+    cfg->desktop_section.slideshow_interval = 600;
 #if FM_CHECK_VERSION(1, 2, 0)
     cfg->desktop_section.show_documents = FALSE;
     cfg->desktop_section.show_trash = TRUE;
@@ -564,6 +568,7 @@ void fm_app_config_load_desktop_config(GKeyFile *kf, const char *group, FmDeskto
     cfg->desktop_sort_by = COL_FILE_MTIME;
 #endif
     cfg->wallpaper_common = TRUE;
+    cfg->slideshow_interval = 600;
 #if FM_CHECK_VERSION(1, 2, 0)
     cfg->show_trash = TRUE;
 #endif
@@ -616,6 +621,7 @@ void fm_app_config_load_desktop_config(GKeyFile *kf, const char *group, FmDeskto
         g_free(cfg->wallpaper);
         cfg->wallpaper = tmp;
     }
+    fm_key_file_get_int(kf, group, "slideshow_interval", &cfg->slideshow_interval);
 
     tmp = g_key_file_get_string(kf, group, "desktop_bg", NULL);
     if(tmp)
@@ -660,6 +666,9 @@ void fm_app_config_load_from_key_file(FmAppConfig* cfg, GKeyFile* kf)
 
     /* behavior */
     fm_key_file_get_int(kf, "config", "bm_open_method", &cfg->bm_open_method);
+    fm_key_file_get_int(kf, "config", "wallpaper_cache_size", &cfg->wallpaper_cache_size);
+    fm_key_file_get_int(kf, "config", "wallpaper_disk_cache_size", &cfg->wallpaper_disk_cache_size);
+    fm_key_file_get_int(kf, "config", "trash_update_interval", &cfg->trash_update_interval);
     /*tmp = g_key_file_get_string(kf, "config", "su_cmd", NULL);
     g_free(cfg->su_cmd);
     cfg->su_cmd = tmp;*/
@@ -1047,6 +1056,7 @@ void fm_app_config_save_desktop_config(GString *buf, const char *group, FmDeskto
     }
     if (cfg->wallpaper_common && cfg->wallpaper)
         g_string_append_printf(buf, "wallpaper=%s\n", cfg->wallpaper);
+    g_string_append_printf(buf, "slideshow_interval=%d\n", cfg->slideshow_interval);
     g_string_append_printf(buf, "desktop_bg=#%02x%02x%02x\n",
                            cfg->desktop_bg.red/257,
                            cfg->desktop_bg.green/257,
@@ -1098,6 +1108,9 @@ void fm_app_config_save_profile(FmAppConfig* cfg, const char* name)
 
         g_string_append(buf, "[config]\n");
         g_string_append_printf(buf, "bm_open_method=%d\n", cfg->bm_open_method);
+        g_string_append_printf(buf, "wallpaper_cache_size=%d\n", cfg->wallpaper_cache_size);
+        g_string_append_printf(buf, "wallpaper_disk_cache_size=%d\n", cfg->wallpaper_disk_cache_size);
+        g_string_append_printf(buf, "trash_update_interval=%d\n", cfg->trash_update_interval);
         /*if(cfg->su_cmd && *cfg->su_cmd)
             g_string_append_printf(buf, "su_cmd=%s\n", cfg->su_cmd);*/
 #if FM_CHECK_VERSION(1, 2, 0)
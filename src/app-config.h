@@ -73,6 +73,7 @@ typedef struct
     char** wallpapers;
     int wallpapers_configured;
     gboolean wallpaper_common;
+    int slideshow_interval; /* in seconds, if wallpaper is a directory */
     gint configured : 1;
     gint changed : 1;
     GdkColor desktop_bg;
@@ -106,6 +107,9 @@ struct _FmAppConfig
     FmConfig parent;
     /* config */
     int bm_open_method;
+    int wallpaper_cache_size; /* in MiB, limits memory used by wallpapers */
+    int wallpaper_disk_cache_size; /* in MiB, limits wallpapers cached on disk */
+    int trash_update_interval; /* in ms, trash can icon updates on the desktop */
 
     /* volume */
     gboolean mount_on_startup;
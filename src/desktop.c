@@ -38,11 +38,22 @@
 #ifdef HAVE_X11
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 #endif
 #ifdef HAVE_WAYLAND
 #include <gtk-layer-shell/gtk-layer-shell.h>
 #endif
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <glib/gstdio.h>
 
 #ifdef HAVE_X11
 #include <cairo-xlib.h>
@@ -51,6 +62,7 @@
 #endif
 
 #include "pref.h"
+#include "wallpaper-scale.h"
 #include "main-win.h"
 
 #include "gseal-gtk-compat.h"
@@ -90,11 +102,27 @@ struct _FmDesktopItem
     gboolean is_rubber_banded : 1;
     gboolean is_prelight : 1;
     gboolean fixed_pos : 1;
+    gboolean in_grid : 1; /* is added into desktop->hit_grid */
+    gboolean hidden : 1; /* doesn't fit into the screen, its size is unknown */
+    gboolean selection_notify : 1; /* selection change isn't reported to ATK yet */
+    guint index; /* position in the model and in desktop->items */
+    guint16 grid_x1, grid_y1, grid_x2, grid_y2; /* buckets occupied in the grid */
+    PangoLayout* layout; /* shaped label, valid if layout_serial is actual */
+    guint layout_serial;
+    PangoRectangle text_extents; /* logical extents of the layout */
+    char* search_name; /* casefolded and normalized name for the search */
+    /* rendered item, normal and selected, see get_item_surface() */
+#if GTK_CHECK_VERSION(3, 0, 0)
+    cairo_surface_t* surface[2];
+#else
+    GdkPixmap* surface[2]; /* with alpha */
+#endif
+    guint surface_serial;
 };
 
 struct _FmBackgroundCache
 {
-    FmBackgroundCache *next;
+    FmBackgroundCache *next; /* less recently shown one */
     char *filename;
 #if GTK_CHECK_VERSION(3, 0, 0)
     cairo_surface_t *bg;
@@ -103,17 +131,34 @@ struct _FmBackgroundCache
 #endif
     FmWallpaperMode wallpaper_mode;
     time_t mtime;
+    FmWallpaperFile *file; /* referenced while image is cached */
+    /* the rest of the key, see _find_bg_cache() */
+    GdkScreen *screen;
+    GdkColor desktop_bg;
+    int dest_w, dest_h;
+    int x, y;
+    gsize size; /* memory taken by the image */
+    guint shown; /* number of desktops showing it now */
 };
 
 static void queue_layout_items(FmDesktop* desktop);
 static void redraw_item(FmDesktop* desktop, FmDesktopItem* item);
+static void hit_grid_update(FmDesktop* desktop, FmDesktopItem* item);
+static void occupied_mark(FmDesktop* desktop, FmDesktopItem* item);
+static gboolean _bg_job_finished(gpointer data);
+static gboolean _bg_job_equal(FmBackgroundJob *a, FmBackgroundJob *b);
+static void _bg_job_start(FmDesktop *desktop, FmBackgroundJob *job);
+static void _queue_prefetch(FmDesktop *desktop);
+static FmWallpaperFile *_ref_wallpaper_file(FmWallpaperFile *wf);
+static void _unref_wallpaper_file(FmWallpaperFile *wf);
+static void reconnect_model(FmDesktop *desktop);
 
 static FmFileInfoList* _dup_selected_files(FmFolderView* fv);
 static FmPathList* _dup_selected_file_paths(FmFolderView* fv);
 static void _select_all(FmFolderView* fv);
 static void _unselect_all(FmFolderView* fv);
 
-static FmDesktopItem* hit_test(FmDesktop* self, GtkTreeIter *it, int x, int y);
+static FmDesktopItem* hit_test(FmDesktop* self, int x, int y);
 
 static void fm_desktop_view_init(FmFolderViewInterface* iface);
 
@@ -201,7 +246,7 @@ static GSList *mounts = NULL;
 /* ---------------------------------------------------------------------
     Items management and common functions */
 
-static char* get_config_file(FmDesktop* desktop, gboolean create_dir)
+static char* get_config_file(FmDesktop* desktop, const char* ext, gboolean create_dir)
 {
     char *dir, *path;
     int i;
@@ -212,18 +257,41 @@ static char* get_config_file(FmDesktop* desktop, gboolean create_dir)
     if(i >= n_screens)
         return NULL;
     dir = pcmanfm_get_profile_dir(create_dir);
-    path = g_strdup_printf("%s/desktop-items-%u.conf", dir, i);
+    path = g_strdup_printf("%s/desktop-items-%u.%s", dir, i, ext);
     g_free(dir);
     return path;
 }
 
+/* the desktop which got user input last, the sort order of the model shared
+   by several desktops is changed from its menu, see on_sort_changed().
+   The owning desktop cannot be passed explicitly: the libfm folder menu
+   re-sorts the model itself and "sort-column-changed" doesn't tell which
+   view asked for it. So this works only for changes made by the user from
+   the menu; the model should not be re-sorted any other way while shared,
+   otherwise the change is taken as made on the desktop with last input
+   and other desktops sharing the model are moved to models of their own */
+static FmDesktop *active_desktop = NULL;
+
+/* returns TRUE if the model of the desktop is used also by any of first
+   n desktops, see connect_model() */
+static gboolean is_model_shared(FmDesktop* desktop, int n)
+{
+    int i;
+
+    if (desktop->model == NULL)
+        return FALSE;
+    for (i = 0; i < n; i++)
+        if (desktops[i] && desktops[i] != desktop && desktops[i]->model == desktop->model)
+            return TRUE;
+    return FALSE;
+}
+
 static inline FmDesktopItem* desktop_item_new(FmFolderModel* model, GtkTreeIter* it)
 {
     FmDesktopItem* item = g_slice_new0(FmDesktopItem);
 #if FM_CHECK_VERSION(1, 2, 0)
     GSList *sl;
 #endif
-    fm_folder_model_set_item_userdata(model, it, item);
     gtk_tree_model_get(GTK_TREE_MODEL(model), it, FM_FOLDER_MODEL_COL_INFO, &item->fi, -1);
     fm_file_info_ref(item->fi);
 #if FM_CHECK_VERSION(1, 2, 0)
@@ -241,13 +309,123 @@ static inline FmDesktopItem* desktop_item_new(FmFolderModel* model, GtkTreeIter*
     return item;
 }
 
+static void desktop_item_free_surfaces(FmDesktopItem* item)
+{
+    int i;
+
+    for (i = 0; i < 2; i++)
+        if (item->surface[i] != NULL)
+        {
+#if GTK_CHECK_VERSION(3, 0, 0)
+            cairo_surface_destroy(item->surface[i]);
+#else
+            g_object_unref(item->surface[i]);
+#endif
+            item->surface[i] = NULL;
+        }
+}
+
 static inline void desktop_item_free(FmDesktopItem* item)
 {
     if(item->fi)
         fm_file_info_unref(item->fi);
+    if(item->layout)
+        g_object_unref(item->layout);
+    g_free(item->search_name);
+    desktop_item_free_surfaces(item);
     g_slice_free(FmDesktopItem, item);
 }
 
+/* desktop->items mirrors the model so loops over items don't need to walk
+   the model and fetch data of each row; it is updated by the model handlers.
+   The model may be shared by few desktops so item userdata isn't used.
+   Renumbering after each inserted row would make loading a folder O(n^2)
+   so only the lowest changed index is remembered and item->index is fixed
+   by items_index_update() which should be called before it's read. */
+static void items_renumber(FmDesktop* desktop, guint from)
+{
+    desktop->index_dirty_from = MIN(desktop->index_dirty_from, from);
+    /* nav_items_update() calls items_index_update() */
+    desktop->nav_dirty = TRUE;
+}
+
+static void items_index_update(FmDesktop* desktop)
+{
+    guint i;
+
+    for (i = desktop->index_dirty_from; i < desktop->items->len; i++)
+        ((FmDesktopItem*)g_ptr_array_index(desktop->items, i))->index = i;
+    desktop->index_dirty_from = G_MAXUINT;
+}
+
+static void items_insert(FmDesktop* desktop, FmDesktopItem* item, guint n)
+{
+    GPtrArray* items = desktop->items;
+
+    g_ptr_array_add(items, NULL);
+    memmove(&items->pdata[n + 1], &items->pdata[n],
+            (items->len - 1 - n) * sizeof(gpointer));
+    items->pdata[n] = item;
+    items_renumber(desktop, n);
+}
+
+static void items_remove(FmDesktop* desktop, guint n)
+{
+    g_ptr_array_remove_index(desktop->items, n);
+    items_renumber(desktop, n);
+}
+
+static void items_reorder(FmDesktop* desktop, gint* new_order)
+{
+    GPtrArray* items = desktop->items;
+    gpointer* old = g_new(gpointer, items->len);
+    guint i;
+
+    memcpy(old, items->pdata, items->len * sizeof(gpointer));
+    for (i = 0; i < items->len; i++)
+        items->pdata[i] = old[new_order[i]];
+    g_free(old);
+    items_renumber(desktop, 0);
+}
+
+static inline gboolean get_item_iter(FmDesktop* desktop, FmDesktopItem* item, GtkTreeIter* it)
+{
+    items_index_update(desktop);
+    return gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(desktop->model), it, NULL, item->index);
+}
+
+/* returns new reference to the icon of the item */
+static GdkPixbuf* get_item_icon(FmDesktop* desktop, FmDesktopItem* item)
+{
+    GdkPixbuf* icon = NULL;
+    GtkTreeIter it;
+
+    if (get_item_iter(desktop, item, &it))
+        gtk_tree_model_get(GTK_TREE_MODEL(desktop->model), &it,
+                           FM_FOLDER_MODEL_COL_ICON, &icon, -1);
+    return icon;
+}
+
+/* returns the label layout for the item, the text is shaped again only
+   after the name, the font or the text size was changed */
+static PangoLayout* get_item_layout(FmDesktop* desktop, FmDesktopItem* item)
+{
+    if (item->layout != NULL && item->layout_serial == desktop->text_serial)
+        return item->layout;
+    if (item->layout != NULL)
+        g_object_unref(item->layout);
+    /* rendered label is invalid as well */
+    desktop_item_free_surfaces(item);
+    /* copy alignment, wrapping and ellipsizing from the desktop layout */
+    item->layout = pango_layout_copy(desktop->pl);
+    pango_layout_set_height(item->layout, desktop->pango_text_h);
+    pango_layout_set_width(item->layout, desktop->pango_text_w);
+    pango_layout_set_text(item->layout, fm_file_info_get_disp_name(item->fi), -1);
+    pango_layout_get_pixel_extents(item->layout, NULL, &item->text_extents);
+    item->layout_serial = desktop->text_serial;
+    return item->layout;
+}
+
 static void calc_item_size(FmDesktop* desktop, FmDesktopItem* item, GdkPixbuf* icon)
 {
     PangoRectangle rc2;
@@ -268,13 +446,8 @@ static void calc_item_size(FmDesktop* desktop, FmDesktopItem* item, GdkPixbuf* i
     item->icon_rect.height += desktop->spacing; // FIXME: this is probably wrong
 
     /* text label rect */
-    pango_layout_set_text(desktop->pl, NULL, 0);
-    pango_layout_set_height(desktop->pl, desktop->pango_text_h);
-    pango_layout_set_width(desktop->pl, desktop->pango_text_w);
-    pango_layout_set_text(desktop->pl, fm_file_info_get_disp_name(item->fi), -1);
-
-    pango_layout_get_pixel_extents(desktop->pl, NULL, &rc2);
-    pango_layout_set_text(desktop->pl, NULL, 0);
+    get_item_layout(desktop, item);
+    rc2 = item->text_extents;
 
     /* FIXME: RTL */
     item->text_rect.x = item->area.x + (desktop->cell_w - rc2.width - 4) / 2;
@@ -285,59 +458,196 @@ static void calc_item_size(FmDesktop* desktop, FmDesktopItem* item, GdkPixbuf* i
     item->area.height = item->text_rect.y + item->text_rect.height - item->area.y;
 }
 
-/* unfortunately we cannot load the "*" together with items because
-   otherwise we will update pango layout on each load_items() which
-   is resource wasting so we load config file once more instead */
-static inline void load_config(FmDesktop* desktop)
+/* positions of fixed items are kept in memory as they were saved last
+   time; moves are appended to a small binary log desktop-items-N.pos and
+   desktop-items-N.conf is rewritten with all positions only when the
+   desktop config is changed or the log grows too long */
+typedef struct
+{
+    gint x;
+    gint y;
+} FmDesktopItemPos;
+
+#define POS_LOG_MAGIC "FMDPOS1\n"
+#define POS_LOG_MAGIC_LEN 8
+#define POS_LOG_SET 'S'
+#define POS_LOG_REMOVE 'R'
+#define POS_LOG_RECORD_LEN 11 /* type, x, y, name length; then the name */
+#define POS_LOG_MAX_RECORDS(n) (64 + 2 * (n))
+
+static void item_pos_free(gpointer data)
+{
+    g_slice_free(FmDesktopItemPos, data);
+}
+
+/* takes ownership on name */
+static void set_item_pos(FmDesktop* desktop, char* name, gint x, gint y)
+{
+    FmDesktopItemPos* pos = g_slice_new(FmDesktopItemPos);
+
+    pos->x = x;
+    pos->y = y;
+    g_hash_table_replace(desktop->positions, name, pos);
+}
+
+static void pos_log_append(GString* buf, char type, const char* name, gint x, gint y)
+{
+    gsize len = MIN(strlen(name), G_MAXUINT16);
+    gint32 v;
+    guint16 n;
+
+    g_string_append_c(buf, type);
+    v = GINT32_TO_LE(x);
+    g_string_append_len(buf, (char*)&v, 4);
+    v = GINT32_TO_LE(y);
+    g_string_append_len(buf, (char*)&v, 4);
+    n = GUINT16_TO_LE((guint16)len);
+    g_string_append_len(buf, (char*)&n, 2);
+    g_string_append_len(buf, name, len);
+}
+
+static void pos_log_replay(FmDesktop* desktop)
+{
+    char *path, *data, *p, *end, *name;
+    gsize len;
+    gint32 x, y;
+    guint16 n;
+
+    desktop->n_pos_log = 0;
+    path = get_config_file(desktop, "pos", FALSE);
+    if (!path)
+        return;
+    if (!g_file_get_contents(path, &data, &len, NULL))
+    {
+        g_free(path);
+        return;
+    }
+    g_free(path);
+    end = data + len;
+    if (len < POS_LOG_MAGIC_LEN || memcmp(data, POS_LOG_MAGIC, POS_LOG_MAGIC_LEN) != 0)
+        p = NULL; /* don't append to unknown file */
+    else for (p = data + POS_LOG_MAGIC_LEN; end - p >= POS_LOG_RECORD_LEN; )
+    {
+        memcpy(&x, p + 1, 4);
+        memcpy(&y, p + 5, 4);
+        memcpy(&n, p + 9, 2);
+        n = GUINT16_FROM_LE(n);
+        if (end - p - POS_LOG_RECORD_LEN < n)
+            break;
+        name = g_strndup(p + POS_LOG_RECORD_LEN, n);
+        if (p[0] == POS_LOG_SET)
+            set_item_pos(desktop, name, GINT32_FROM_LE(x), GINT32_FROM_LE(y));
+        else if (p[0] == POS_LOG_REMOVE)
+        {
+            g_hash_table_remove(desktop->positions, name);
+            g_free(name);
+        }
+        else
+        {
+            g_free(name);
+            break;
+        }
+        p += POS_LOG_RECORD_LEN + n;
+        desktop->n_pos_log++;
+    }
+    /* the log was damaged, rewrite everything on next save */
+    if (p != end)
+        desktop->n_pos_log = G_MAXUINT / 2;
+    g_free(data);
+}
+
+/* positions are imported from groups of the .conf file and then updated
+   from the log */
+static void load_positions(FmDesktop* desktop, GKeyFile* kf)
+{
+    char** groups;
+    guint i;
+
+    g_hash_table_remove_all(desktop->positions);
+    groups = g_key_file_get_groups(kf, NULL);
+    for (i = 0; groups[i]; i++)
+        if (strcmp(groups[i], "*") != 0) /* item "*" is desktop config */
+            set_item_pos(desktop, g_strdup(groups[i]),
+                         g_key_file_get_integer(kf, groups[i], "x", NULL),
+                         g_key_file_get_integer(kf, groups[i], "y", NULL));
+    g_strfreev(groups);
+    pos_log_replay(desktop);
+    desktop->positions_loaded = TRUE;
+}
+
+/* loads positions if the desktop isn't realized yet and load_config()
+   wasn't called, desktop config is not touched */
+static void ensure_positions(FmDesktop* desktop)
 {
     char* path;
     GKeyFile* kf;
 
-    path = get_config_file(desktop, FALSE);
+    if (desktop->positions_loaded)
+        return;
+    path = get_config_file(desktop, "conf", FALSE);
     if(!path)
         return;
     kf = g_key_file_new();
-    if(g_key_file_load_from_file(kf, path, 0, NULL))
-        /* item "*" is desktop config */
-        fm_app_config_load_desktop_config(kf, "*", &desktop->conf);
+    g_key_file_load_from_file(kf, path, 0, NULL);
+    load_positions(desktop, kf);
     g_free(path);
     g_key_file_free(kf);
 }
 
-static inline void load_items(FmDesktop* desktop)
+/* the config file is parsed once, positions are used by load_items() */
+static inline void load_config(FmDesktop* desktop)
 {
-    GtkTreeIter it;
     char* path;
-    GtkTreeModel* model;
     GKeyFile* kf;
+    GString* buf;
 
-    if (desktop->model == NULL)
-        return;
-    model = GTK_TREE_MODEL(desktop->model);
-    if (!gtk_tree_model_get_iter_first(model, &it))
-        return;
-    path = get_config_file(desktop, FALSE);
+    path = get_config_file(desktop, "conf", FALSE);
     if(!path)
         return;
     kf = g_key_file_new();
     if(g_key_file_load_from_file(kf, path, 0, NULL))
+        /* item "*" is desktop config */
+        fm_app_config_load_desktop_config(kf, "*", &desktop->conf);
+    load_positions(desktop, kf);
+    g_free(path);
+    g_key_file_free(kf);
+    /* remember it to not rewrite the file until config is changed */
+    g_free(desktop->saved_conf);
+    desktop->saved_conf = NULL;
+    if (desktop->conf.configured)
+    {
+        buf = g_string_sized_new(1024);
+        fm_app_config_save_desktop_config(buf, "*", &desktop->conf);
+        g_string_append_c(buf, '\n');
+        desktop->saved_conf = g_string_free(buf, FALSE);
+    }
+}
+
+static inline void load_items(FmDesktop* desktop)
+{
+    guint i;
+
+    if (desktop->model == NULL || desktop->items->len == 0)
+        return;
+    ensure_positions(desktop);
+    if (g_hash_table_size(desktop->positions) > 0)
     {
-        do
+        for(i = 0; i < desktop->items->len; i++)
         {
             FmDesktopItem* item;
-            const char* name;
-            GdkPixbuf* icon = NULL;
+            FmDesktopItemPos* pos;
+            GdkPixbuf* icon;
             int out; /* out of bounds */
 
-            item = fm_folder_model_get_item_userdata(desktop->model, &it);
-            name = fm_file_info_get_name(item->fi);
-            if(g_key_file_has_group(kf, name))
+            item = g_ptr_array_index(desktop->items, i);
+            pos = g_hash_table_lookup(desktop->positions, fm_file_info_get_name(item->fi));
+            if(pos)
             {
-                gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
+                icon = get_item_icon(desktop, item);
                 desktop->fixed_items = g_list_prepend(desktop->fixed_items, item);
                 item->fixed_pos = TRUE;
-                item->area.x = g_key_file_get_integer(kf, name, "x", NULL);
-                item->area.y = g_key_file_get_integer(kf, name, "y", NULL);
+                item->area.x = pos->x;
+                item->area.y = pos->y;
                 /* pull item into screen bounds */
                 if (item->area.x < desktop->xmargin + desktop->working_area.x)
                     item->area.x = desktop->xmargin + desktop->working_area.x;
@@ -363,14 +673,13 @@ static inline void load_items(FmDesktop* desktop)
                     item->icon_rect.y -= out;
                     item->text_rect.y -= out;
                 }
+                hit_grid_update(desktop, item);
+                occupied_mark(desktop, item);
                 if(icon)
                     g_object_unref(icon);
             }
         }
-        while(gtk_tree_model_iter_next(model, &it));
     }
-    g_free(path);
-    g_key_file_free(kf);
     queue_layout_items(desktop);
 }
 
@@ -379,6 +688,7 @@ static inline void unload_items(FmDesktop* desktop)
     /* remove existing fixed items */
     g_list_free(desktop->fixed_items);
     desktop->fixed_items = NULL;
+    desktop->occupied_dirty = TRUE;
     desktop->focus = NULL;
     desktop->drop_hilight = NULL;
     desktop->hover_item = NULL;
@@ -412,33 +722,19 @@ static gint get_desktop_for_root_window(GdkWindow *root)
 }
 #endif
 
-/* save position of desktop icons */
-static void save_item_pos(FmDesktop* desktop)
+/* writes desktop config and all known positions in .conf format */
+static gboolean save_config_file(FmDesktop* desktop, const char* path, GString* buf)
 {
-    GList* l;
-    GString* buf;
-    char* path = get_config_file(desktop, TRUE);
-
-    if(!path)
-        return;
-    buf = g_string_sized_new(1024);
-
-    /* save desktop config */
-    if (desktop->conf.configured)
-    {
-        fm_app_config_save_desktop_config(buf, "*", &desktop->conf);
-        g_string_append_c(buf, '\n');
-    }
+    GHashTableIter hi;
+    FmDesktopItemPos* pos;
+    const char *name, *p;
 
-    /* save all items positions */
-    for(l = desktop->fixed_items; l; l=l->next)
+    g_hash_table_iter_init(&hi, desktop->positions);
+    while (g_hash_table_iter_next(&hi, (gpointer*)&name, (gpointer*)&pos))
     {
-        FmDesktopItem* item = (FmDesktopItem*)l->data;
-        FmPath* fi_path = fm_file_info_get_path(item->fi);
-        const char* p;
         /* write the file basename as group name */
         g_string_append_c(buf, '[');
-        for(p = fm_path_get_basename(fi_path); *p; ++p)
+        for(p = name; *p; ++p)
         {
             switch(*p)
             {
@@ -464,10 +760,99 @@ static void save_item_pos(FmDesktop* desktop)
         g_string_append(buf, "]\n");
         g_string_append_printf(buf, "x=%d\n"
                                     "y=%d\n\n",
-                                    item->area.x, item->area.y);
+                                    pos->x, pos->y);
+    }
+    return g_file_set_contents(path, buf->str, buf->len, NULL);
+}
+
+/* save position of desktop icons */
+static void save_item_pos(FmDesktop* desktop)
+{
+    GHashTable* fixed;
+    GHashTableIter hi;
+    GList* l;
+    GString *buf, *log;
+    FmDesktopItemPos* pos;
+    const char* name;
+    char *path, *log_path, *conf;
+    guint n_records = 0;
+    FILE* f;
+
+    path = get_config_file(desktop, "conf", TRUE);
+    if(!path)
+        return;
+    ensure_positions(desktop);
+    buf = g_string_sized_new(1024);
+    log = g_string_new(NULL);
+
+    /* save desktop config */
+    if (desktop->conf.configured)
+    {
+        fm_app_config_save_desktop_config(buf, "*", &desktop->conf);
+        g_string_append_c(buf, '\n');
+    }
+
+    /* find positions changed since last save */
+    fixed = g_hash_table_new(g_str_hash, g_str_equal);
+    for(l = desktop->fixed_items; l; l=l->next)
+    {
+        FmDesktopItem* item = (FmDesktopItem*)l->data;
+
+        name = fm_path_get_basename(fm_file_info_get_path(item->fi));
+        g_hash_table_insert(fixed, (gpointer)name, item);
+        pos = g_hash_table_lookup(desktop->positions, name);
+        if (pos && pos->x == item->area.x && pos->y == item->area.y)
+            continue;
+        pos_log_append(log, POS_LOG_SET, name, item->area.x, item->area.y);
+        set_item_pos(desktop, g_strdup(name), item->area.x, item->area.y);
+        n_records++;
+    }
+    /* forget items which aren't fixed anymore, but only when the folder is
+       loaded, otherwise we may lose positions of items not loaded yet */
+    if (desktop->model && fm_folder_is_loaded(fm_folder_model_get_folder(desktop->model)))
+    {
+        g_hash_table_iter_init(&hi, desktop->positions);
+        while (g_hash_table_iter_next(&hi, (gpointer*)&name, NULL))
+            if (g_hash_table_lookup(fixed, name) == NULL)
+            {
+                pos_log_append(log, POS_LOG_REMOVE, name, 0, 0);
+                g_hash_table_iter_remove(&hi);
+                n_records++;
+            }
+    }
+    g_hash_table_destroy(fixed);
+
+    log_path = get_config_file(desktop, "pos", TRUE);
+    if (g_strcmp0(buf->str, desktop->saved_conf) != 0 ||
+        desktop->n_pos_log + n_records > POS_LOG_MAX_RECORDS(g_hash_table_size(desktop->positions)))
+    {
+        /* rewrite the .conf file completely, the log is not needed then;
+           buf has config only yet, save_config_file() appends positions */
+        conf = g_strndup(buf->str, buf->len);
+        if (save_config_file(desktop, path, buf))
+        {
+            g_free(desktop->saved_conf);
+            desktop->saved_conf = conf;
+            conf = NULL;
+            g_unlink(log_path);
+            desktop->n_pos_log = 0;
+            n_records = 0; /* they are in the .conf file now */
+        }
+        g_free(conf);
     }
-    g_file_set_contents(path, buf->str, buf->len, NULL);
+    /* if the .conf file could not be written then changes go to the log */
+    if (n_records > 0 && (f = g_fopen(log_path, "ab")) != NULL)
+    {
+        fseek(f, 0, SEEK_END);
+        if (ftell(f) == 0)
+            fwrite(POS_LOG_MAGIC, 1, POS_LOG_MAGIC_LEN, f);
+        fwrite(log->str, 1, log->len, f);
+        fclose(f);
+        desktop->n_pos_log += n_records;
+    }
+    g_free(log_path);
     g_free(path);
+    g_string_free(log, TRUE);
     g_string_free(buf, TRUE);
     desktop->conf.changed = FALSE; /* reset it since we saved it */
 }
@@ -499,11 +884,11 @@ static GList* get_selected_items(FmDesktop* desktop, int* n_items)
     GList* items = NULL;
     int n = 0;
     FmDesktopItem* focus = NULL;
-    GtkTreeModel* model = desktop->model ? GTK_TREE_MODEL(desktop->model) : NULL;
-    GtkTreeIter it;
-    if(model && gtk_tree_model_get_iter_first(model, &it)) do
+    guint i;
+
+    for(i = 0; i < desktop->items->len; i++)
     {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(desktop->model, &it);
+        FmDesktopItem* item = g_ptr_array_index(desktop->items, i);
         if(item->is_selected)
         {
             if(G_LIKELY(item != desktop->focus))
@@ -515,7 +900,6 @@ static GList* get_selected_items(FmDesktop* desktop, int* n_items)
                 focus = item;
         }
     }
-    while(gtk_tree_model_iter_next(model, &it));
     items = g_list_reverse(items);
     if(focus)
     {
@@ -543,6 +927,7 @@ static void copy_desktop_config(FmDesktopConfig *dst, FmDesktopConfig *src)
         dst->wallpapers = NULL;
     dst->wallpapers_configured = src->wallpapers_configured;
     dst->wallpaper_common = src->wallpaper_common;
+    dst->slideshow_interval = src->slideshow_interval;
     dst->show_wm_menu = src->show_wm_menu;
     dst->configured = TRUE;
     dst->changed = FALSE;
@@ -565,74 +950,125 @@ static GVolumeMonitor *vol_mon = NULL;
 
 static void _free_extra_item(FmDesktopExtraItem *item);
 
-static gboolean on_idle_extra_item_add(gpointer user_data)
+/* extra items changes are collected and applied once per main loop iteration */
+static GSList *extra_items_added = NULL; /* FmDesktopExtraItem with file info */
+static GSList *extra_items_removed = NULL; /* GMount */
+static guint extra_items_idle = 0;
+
+static void _remove_mount_item(GMount *mount)
 {
-    FmDesktopExtraItem *item = user_data;
+    GSList *sl;
+    FmDesktopExtraItem *item;
     int i;
 
-    /* if mount is not NULL then it's new mount so add it to the list */
-    if (item->mount)
+    for (sl = mounts; sl; sl = sl->next)
     {
-        mounts = g_slist_append(mounts, item);
-        /* add it to all models that watch mounts */
-        for (i = 0; i < n_screens; i++)
-            if (desktops[i]->monitor >= 0 && desktops[i]->conf.show_mounts
-                && desktops[i]->model)
-                fm_folder_model_extra_file_add(desktops[i]->model, item->fi,
-                                               FM_FOLDER_MODEL_ITEMPOS_POST);
+        item = sl->data;
+        if (item->mount == mount)
+            break;
     }
-    else if (item == documents)
+    if (sl)
     {
-        /* add it to all models that watch documents */
         for (i = 0; i < n_screens; i++)
-            if (desktops[i]->monitor >= 0 && desktops[i]->conf.show_documents
-                && desktops[i]->model)
-            {
-                fm_folder_model_extra_file_add(desktops[i]->model, item->fi,
-                                               FM_FOLDER_MODEL_ITEMPOS_PRE);
-                /* if this is extra item it might be loaded after the folder
-                   therefore we have to reload fixed positions again to apply */
-                reload_items(desktops[i]);
-            }
+            if (desktops[i]->monitor >= 0 && desktops[i]->conf.show_mounts
+                && desktops[i]->model && !is_model_shared(desktops[i], i))
+                fm_folder_model_extra_file_remove(desktops[i]->model, item->fi);
+        mounts = g_slist_delete_link(mounts, sl);
+        _free_extra_item(item);
     }
-    else if (item == trash_can)
+    else
+        g_warning("got unmount for unknown desktop item");
+}
+
+static gboolean on_idle_extra_items_update(gpointer user_data)
+{
+    FmDesktopExtraItem *item;
+    GSList *added, *removed, *sl;
+    gboolean reload_documents = FALSE, reload_trash = FALSE;
+    int i;
+
+    if (g_source_is_destroyed(g_main_current_source()))
+        return FALSE;
+    extra_items_idle = 0;
+    added = g_slist_reverse(extra_items_added);
+    removed = g_slist_reverse(extra_items_removed);
+    extra_items_added = extra_items_removed = NULL;
+    for (sl = added; sl; sl = sl->next)
     {
-        /* add it to all models that watch trash can */
-        for (i = 0; i < n_screens; i++)
-            if (desktops[i]->monitor >= 0 && desktops[i]->conf.show_trash
-                && desktops[i]->model)
-            {
-                fm_folder_model_extra_file_add(desktops[i]->model, item->fi,
-                                               FM_FOLDER_MODEL_ITEMPOS_PRE);
-                reload_items(desktops[i]);
-            }
+        item = sl->data;
+        /* if mount is not NULL then it's new mount so add it to the list */
+        if (item->mount)
+        {
+            mounts = g_slist_append(mounts, item);
+            /* add it to all models that watch mounts */
+            for (i = 0; i < n_screens; i++)
+                if (desktops[i]->monitor >= 0 && desktops[i]->conf.show_mounts
+                    && desktops[i]->model && !is_model_shared(desktops[i], i))
+                    fm_folder_model_extra_file_add(desktops[i]->model, item->fi,
+                                                   FM_FOLDER_MODEL_ITEMPOS_POST);
+        }
+        else if (item == documents)
+        {
+            /* add it to all models that watch documents */
+            for (i = 0; i < n_screens; i++)
+                if (desktops[i]->monitor >= 0 && desktops[i]->conf.show_documents
+                    && desktops[i]->model && !is_model_shared(desktops[i], i))
+                    fm_folder_model_extra_file_add(desktops[i]->model, item->fi,
+                                                   FM_FOLDER_MODEL_ITEMPOS_PRE);
+            reload_documents = TRUE;
+        }
+        else if (item == trash_can)
+        {
+            /* add it to all models that watch trash can */
+            for (i = 0; i < n_screens; i++)
+                if (desktops[i]->monitor >= 0 && desktops[i]->conf.show_trash
+                    && desktops[i]->model && !is_model_shared(desktops[i], i))
+                    fm_folder_model_extra_file_add(desktops[i]->model, item->fi,
+                                                   FM_FOLDER_MODEL_ITEMPOS_PRE);
+            reload_trash = TRUE;
+        }
+        else
+        {
+            g_critical("got file info for unknown desktop item %s",
+                       fm_path_get_basename(item->path));
+            _free_extra_item(item);
+        }
     }
-    else
+    g_slist_free(added);
+    for (sl = removed; sl; sl = sl->next)
     {
-        g_critical("got file info for unknown desktop item %s",
-                   fm_path_get_basename(item->path));
-        _free_extra_item(item);
+        _remove_mount_item(sl->data);
+        g_object_unref(sl->data);
     }
+    g_slist_free(removed);
+    /* if this is extra item it might be loaded after the folder therefore
+       we have to reload fixed positions again to apply, do it only once */
+    if (reload_documents || reload_trash)
+        for (i = 0; i < n_screens; i++)
+            if (desktops[i]->monitor >= 0 && desktops[i]->model
+                && ((reload_documents && desktops[i]->conf.show_documents)
+                    || (reload_trash && desktops[i]->conf.show_trash)))
+                reload_items(desktops[i]);
     return FALSE;
 }
 
+static inline void queue_extra_items_update(void)
+{
+    if (extra_items_idle == 0)
+        extra_items_idle = gdk_threads_add_idle(on_idle_extra_items_update, NULL);
+}
+
 static gboolean trash_is_empty = FALSE; /* startup default */
+static GCancellable *trash_query = NULL; /* query of trash state is running */
+static gboolean trash_query_again = FALSE; /* trash was changed while querying */
+static guint trash_update_timeout = 0;
 
 /* returns TRUE if model should be updated */
-static gboolean _update_trash_icon(FmDesktopExtraItem *item)
+static gboolean _update_trash_icon(FmDesktopExtraItem *item, guint32 n)
 {
-    GFile *gf = fm_file_new_for_uri("trash:///");
-    GFileInfo *inf = g_file_query_info(gf, G_FILE_ATTRIBUTE_TRASH_ITEM_COUNT, 0, NULL, NULL);
     const char *icon_name;
     GIcon *icon;
-    guint32 n;
 
-    g_object_unref(gf);
-    if (!inf)
-        return FALSE;
-
-    n = g_file_info_get_attribute_uint32(inf, G_FILE_ATTRIBUTE_TRASH_ITEM_COUNT);
-    g_object_unref(inf);
     if (n > 0 && trash_is_empty)
         icon_name = "user-trash-full";
     else if (n == 0 && !trash_is_empty)
@@ -646,20 +1082,81 @@ static gboolean _update_trash_icon(FmDesktopExtraItem *item)
     return TRUE;
 }
 
-static void on_file_info_job_finished(FmFileInfoJob* job, gpointer user_data)
+static void _query_trash_state(FmDesktopExtraItem *item);
+static gboolean on_trash_update_timeout(gpointer user_data);
+
+static void on_trash_info_ready(GObject *obj, GAsyncResult *res, gpointer user_data)
 {
     FmDesktopExtraItem *item = user_data;
-    FmFileInfo *fi;
-    char *name;
-    GIcon *icon;
+    GFileInfo *inf;
+    GError *err = NULL;
+    guint32 n;
+    int i;
 
-    if(fm_file_info_list_is_empty(job->file_infos))
+    inf = g_file_query_info_finish(G_FILE(obj), res, &err);
+    if (inf == NULL)
     {
-        /* failed */
-        g_critical("FmFileInfoJob failed on desktop mount update");
-        _free_extra_item(item);
-        return;
-    }
+        gboolean cancelled = g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+        g_error_free(err);
+        if (cancelled) /* the item is freed already */
+            return;
+    }
+    g_object_unref(trash_query);
+    trash_query = NULL;
+    if (inf)
+    {
+        n = g_file_info_get_attribute_uint32(inf, G_FILE_ATTRIBUTE_TRASH_ITEM_COUNT);
+        g_object_unref(inf);
+        /* models are updated only if trash became empty or not empty */
+        if (_update_trash_icon(item, n))
+            for (i = 0; i < n_screens; i++)
+                if (desktops[i]->monitor >= 0 && desktops[i]->conf.show_trash
+                    && desktops[i]->model && !is_model_shared(desktops[i], i))
+                    fm_folder_model_file_changed(desktops[i]->model, item->fi);
+    }
+    /* trash was changed while querying, query it again after the interval
+       as on_trash_changed() does, unless the timer is armed already */
+    if (trash_query_again)
+    {
+        trash_query_again = FALSE;
+        if (trash_update_timeout == 0)
+            trash_update_timeout = gdk_threads_add_timeout(MAX(app_config->trash_update_interval, 0),
+                                                           on_trash_update_timeout, item);
+    }
+}
+
+static void _query_trash_state(FmDesktopExtraItem *item)
+{
+    GFile *gf;
+
+    if (trash_query)
+    {
+        trash_query_again = TRUE;
+        return;
+    }
+    trash_query = g_cancellable_new();
+    gf = fm_file_new_for_uri("trash:///");
+    g_file_query_info_async(gf, G_FILE_ATTRIBUTE_TRASH_ITEM_COUNT,
+                            G_FILE_QUERY_INFO_NONE, G_PRIORITY_LOW, trash_query,
+                            on_trash_info_ready, item);
+    g_object_unref(gf);
+}
+
+static void on_file_info_job_finished(FmFileInfoJob* job, gpointer user_data)
+{
+    FmDesktopExtraItem *item = user_data;
+    FmFileInfo *fi;
+    char *name;
+    GIcon *icon;
+
+    if(fm_file_info_list_is_empty(job->file_infos))
+    {
+        /* failed */
+        g_critical("FmFileInfoJob failed on desktop mount update");
+        _free_extra_item(item);
+        return;
+    }
     fi = fm_file_info_list_peek_head(job->file_infos);
     /* FIXME: check for duplicates? */
     item->fi = fm_file_info_ref(fi);
@@ -677,9 +1174,10 @@ static void on_file_info_job_finished(FmFileInfoJob* job, gpointer user_data)
     }
     /* update trash can icon */
     else if (item == trash_can)
-        _update_trash_icon(item);
+        _query_trash_state(item);
     /* queue adding item to the list and folder models */
-    gdk_threads_add_idle(on_idle_extra_item_add, item);
+    extra_items_added = g_slist_prepend(extra_items_added, item);
+    queue_extra_items_update();
 }
 
 static void _free_extra_item(FmDesktopExtraItem *item)
@@ -721,38 +1219,11 @@ static void on_mount_added(GVolumeMonitor *volume_monitor, GMount *mount,
     }
 }
 
-static gboolean on_idle_extra_item_remove(gpointer user_data)
-{
-    GMount *mount = user_data;
-    GSList *sl;
-    FmDesktopExtraItem *item;
-    int i;
-
-    for (sl = mounts; sl; sl = sl->next)
-    {
-        item = sl->data;
-        if (item->mount == mount)
-            break;
-    }
-    if (sl)
-    {
-        for (i = 0; i < n_screens; i++)
-            if (desktops[i]->monitor >= 0 && desktops[i]->conf.show_mounts
-                && desktops[i]->model)
-                fm_folder_model_extra_file_remove(desktops[i]->model, item->fi);
-        mounts = g_slist_delete_link(mounts, sl);
-        _free_extra_item(item);
-    }
-    else
-        g_warning("got unmount for unknown desktop item");
-    g_object_unref(mount);
-    return FALSE;
-}
-
 static void on_mount_removed(GVolumeMonitor *volume_monitor, GMount *mount,
                              gpointer _unused)
 {
-    gdk_threads_add_idle(on_idle_extra_item_remove, g_object_ref(mount));
+    extra_items_removed = g_slist_prepend(extra_items_removed, g_object_ref(mount));
+    queue_extra_items_update();
 }
 
 
@@ -761,17 +1232,23 @@ static void on_mount_removed(GVolumeMonitor *volume_monitor, GMount *mount,
 
 static GFileMonitor *trash_monitor = NULL;
 
+static gboolean on_trash_update_timeout(gpointer user_data)
+{
+    if (g_source_is_destroyed(g_main_current_source()))
+        return FALSE;
+    trash_update_timeout = 0;
+    _query_trash_state(user_data);
+    return FALSE;
+}
+
 static void on_trash_changed(GFileMonitor *monitor, GFile *gf, GFile *other,
                              GFileMonitorEvent evt, FmDesktopExtraItem *item)
 {
-    int i;
-
-    if (!_update_trash_icon(item))
-        return;
-    for (i = 0; i < n_screens; i++)
-        if (desktops[i]->monitor >= 0 && desktops[i]->conf.show_trash
-            && desktops[i]->model)
-            fm_folder_model_file_changed(desktops[i]->model, item->fi);
+    /* emptying the trash can sends an event for each file in it so query
+       the state only once per interval */
+    if (trash_update_timeout == 0)
+        trash_update_timeout = gdk_threads_add_timeout(MAX(app_config->trash_update_interval, 0),
+                                                       on_trash_update_timeout, item);
 }
 
 static FmDesktopExtraItem *_add_extra_item(const char *path_str)
@@ -931,19 +1408,12 @@ static void atk_component_item_interface_init(AtkComponentIface *iface)
     iface->grab_focus = fm_desktop_item_accessible_grab_focus;
 }
 
-/* NOTE: this is not very fast */
 static GtkTreePath *fm_desktop_item_get_tree_path(FmDesktop *self, FmDesktopItem *item)
 {
-    GtkTreeModel *model = self->model ? GTK_TREE_MODEL(self->model) : NULL;
-    GtkTreeIter it;
-
-    if(model && gtk_tree_model_get_iter_first(model, &it)) do
-    {
-        if (fm_folder_model_get_item_userdata(self->model, &it) == item)
-            return gtk_tree_model_get_path(model, &it);
-    }
-    while (gtk_tree_model_iter_next(model, &it));
-    return NULL;
+    items_index_update(self);
+    if (item->index >= self->items->len || g_ptr_array_index(self->items, item->index) != item)
+        return NULL;
+    return gtk_tree_path_new_from_indices(item->index, -1);
 }
 
 static gboolean fm_desktop_item_accessible_idle_do_action(gpointer data)
@@ -961,6 +1431,7 @@ static gboolean fm_desktop_item_accessible_idle_do_action(gpointer data)
         tp = fm_desktop_item_get_tree_path(FM_DESKTOP(item->widget), item->item);
         if (tp)
         {
+            active_desktop = FM_DESKTOP(item->widget);
             fm_folder_view_item_clicked(FM_FOLDER_VIEW(item->widget), tp,
                                         item->action_type == 0 ? FM_FV_ACTIVATED : FM_FV_CONTEXT_MENU);
             gtk_tree_path_free(tp);
@@ -1227,13 +1698,12 @@ static AtkObject *fm_desktop_accessible_ref_accessible_at_point(AtkComponent *co
     gint x_pos, y_pos;
     FmDesktopItem *item;
     GList *obj_l = NULL;
-    GtkTreeIter it;
 
     if (widget == NULL)
         return NULL;
     desktop = FM_DESKTOP(widget);
     atk_component_get_extents(component, &x_pos, &y_pos, NULL, NULL, coord_type);
-    item = hit_test(desktop, &it, x - x_pos, y - y_pos);
+    item = hit_test(desktop, x - x_pos, y - y_pos);
     if (item)
         obj_l = fm_desktop_find_accessible_for_item(FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(component), item);
     if (obj_l)
@@ -1391,7 +1861,10 @@ static gboolean fm_desktop_accessible_idle_do_action(gpointer data)
     priv->action_idle_handler = 0;
     widget = gtk_accessible_get_widget(GTK_ACCESSIBLE(data));
     if (widget)
+    {
+        active_desktop = FM_DESKTOP(widget);
         fm_folder_view_item_clicked(FM_FOLDER_VIEW(widget), NULL, FM_FV_CONTEXT_MENU);
+    }
     return FALSE;
 }
 
@@ -1658,6 +2131,37 @@ static void fm_desktop_item_selected_changed(FmDesktop *desktop, FmDesktopItem *
     }
 }
 
+/* reports selection change of all items in the list at once */
+static void fm_desktop_items_selection_changed(FmDesktop *desktop, GSList *items)
+{
+    AtkObject *obj;
+    FmDesktopAccessiblePriv *priv;
+    FmDesktopItemAccessible *item_atk;
+    GSList *sl;
+    GList *l;
+
+    if (items == NULL)
+        return;
+    obj = gtk_widget_get_accessible(GTK_WIDGET(desktop));
+    if (obj != NULL && FM_IS_DESKTOP_ACCESSIBLE(obj))
+    {
+        priv = FM_DESKTOP_ACCESSIBLE_GET_PRIVATE(obj);
+        for (sl = items; sl; sl = sl->next)
+            ((FmDesktopItem *)sl->data)->selection_notify = TRUE;
+        /* walk accessibles once instead of searching for each item */
+        for (l = priv->items; l; l = l->next)
+        {
+            item_atk = l->data;
+            if (item_atk->item && item_atk->item->selection_notify)
+                atk_object_notify_state_change(ATK_OBJECT(item_atk), ATK_STATE_SELECTED,
+                                               item_atk->item->is_selected);
+        }
+        for (sl = items; sl; sl = sl->next)
+            ((FmDesktopItem *)sl->data)->selection_notify = FALSE;
+        g_signal_emit_by_name(obj, "selection-changed");
+    }
+}
+
 static void fm_desktop_accessible_focus_set(FmDesktop *desktop, FmDesktopItem *item)
 {
     AtkObject *obj;
@@ -1721,108 +2225,348 @@ static inline void get_item_rect(FmDesktopItem* item, GdkRectangle* rect)
     gdk_rectangle_union(&item->icon_rect, &item->text_rect, rect);
 }
 
-static gboolean is_pos_occupied(FmDesktop* desktop, FmDesktopItem* item)
+/* items are indexed in a grid of cell_w x cell_h buckets so hit testing
+   has to check only few items in the bucket instead of the whole model */
+static inline guint hit_grid_index(gint v, guint cell, guint n)
+{
+    if (v < 0)
+        return 0;
+    v /= (gint)cell;
+    return MIN((guint)v, n - 1);
+}
+
+static void hit_grid_remove(FmDesktop* desktop, FmDesktopItem* item)
+{
+    GSList **bucket;
+    guint x, y;
+
+    desktop->nav_dirty = TRUE;
+    if (!item->in_grid || desktop->hit_grid == NULL)
+        return;
+    item->in_grid = FALSE;
+    for (y = item->grid_y1; y <= item->grid_y2; y++)
+        for (x = item->grid_x1; x <= item->grid_x2; x++)
+        {
+            bucket = &desktop->hit_grid[y * desktop->hit_grid_cols + x];
+            *bucket = g_slist_remove(*bucket, item);
+        }
+}
+
+static void hit_grid_add(FmDesktop* desktop, FmDesktopItem* item)
+{
+    GdkRectangle rect;
+    GSList **bucket;
+    guint x, y;
+
+    desktop->nav_dirty = TRUE;
+    if (desktop->hit_grid == NULL || item->in_grid || item->hidden)
+        return;
+    get_item_rect(item, &rect);
+    item->grid_x1 = hit_grid_index(rect.x, desktop->cell_w, desktop->hit_grid_cols);
+    item->grid_x2 = hit_grid_index(rect.x + rect.width - 1, desktop->cell_w,
+                                   desktop->hit_grid_cols);
+    item->grid_y1 = hit_grid_index(rect.y, desktop->cell_h, desktop->hit_grid_rows);
+    item->grid_y2 = hit_grid_index(rect.y + rect.height - 1, desktop->cell_h,
+                                   desktop->hit_grid_rows);
+    item->in_grid = TRUE;
+    /* order in the bucket doesn't matter, moved items are added again
+       anyway, hit_test() compares item->index instead */
+    for (y = item->grid_y1; y <= item->grid_y2; y++)
+        for (x = item->grid_x1; x <= item->grid_x2; x++)
+        {
+            bucket = &desktop->hit_grid[y * desktop->hit_grid_cols + x];
+            *bucket = g_slist_prepend(*bucket, item);
+        }
+}
+
+static void hit_grid_update(FmDesktop* desktop, FmDesktopItem* item)
+{
+    hit_grid_remove(desktop, item);
+    hit_grid_add(desktop, item);
+}
+
+/* frees the grid without touching items, they may be already freed */
+static void hit_grid_free(FmDesktop* desktop)
+{
+    guint i;
+
+    desktop->nav_dirty = TRUE;
+    if (desktop->hit_grid == NULL)
+        return;
+    for (i = 0; i < desktop->hit_grid_cols * desktop->hit_grid_rows; i++)
+        g_slist_free(desktop->hit_grid[i]);
+    g_free(desktop->hit_grid);
+    desktop->hit_grid = NULL;
+    desktop->hit_grid_cols = desktop->hit_grid_rows = 0;
+}
+
+/* drops all items from the grid and resizes it for the current allocation */
+static void hit_grid_reset(FmDesktop* desktop)
+{
+    GtkAllocation alloc;
+    GSList *l;
+    guint i;
+
+    if (desktop->hit_grid != NULL)
+        for (i = 0; i < desktop->hit_grid_cols * desktop->hit_grid_rows; i++)
+            for (l = desktop->hit_grid[i]; l; l = l->next)
+                ((FmDesktopItem*)l->data)->in_grid = FALSE;
+    hit_grid_free(desktop);
+    if (desktop->cell_w == 0 || desktop->cell_h == 0)
+        return;
+    gtk_widget_get_allocation(GTK_WIDGET(desktop), &alloc);
+    desktop->hit_grid_cols = MAX(alloc.width, 1) / desktop->cell_w + 1;
+    desktop->hit_grid_rows = MAX(alloc.height, 1) / desktop->cell_h + 1;
+    desktop->hit_grid = g_new0(GSList*, desktop->hit_grid_cols * desktop->hit_grid_rows);
+}
+
+/* cells of the layout grid which are taken by fixed items are kept in
+   a bitset so layout_items() doesn't need to scan all the fixed items */
+static inline gint cell_floor(gint v, guint cell)
+{
+    return (v >= 0) ? v / (gint)cell : -((-v + (gint)cell - 1) / (gint)cell);
+}
+
+static gboolean occupied_get_range(FmDesktop* desktop, FmDesktopItem* item,
+                                   gint* c1, gint* c2, gint* r1, gint* r2)
+{
+    GdkRectangle rect;
+
+    get_item_rect(item, &rect);
+    *c1 = cell_floor(rect.x - desktop->occupied_x, desktop->cell_w);
+    *c2 = cell_floor(rect.x + rect.width - 1 - desktop->occupied_x, desktop->cell_w);
+    *r1 = cell_floor(rect.y - desktop->occupied_y, desktop->cell_h);
+    *r2 = cell_floor(rect.y + rect.height - 1 - desktop->occupied_y, desktop->cell_h);
+    if (*c2 < 0 || *r2 < 0 || *c1 >= (gint)desktop->occupied_cols
+        || *r1 >= (gint)desktop->occupied_rows)
+        return FALSE;
+    *c1 = MAX(*c1, 0);
+    *r1 = MAX(*r1, 0);
+    *c2 = MIN(*c2, (gint)desktop->occupied_cols - 1);
+    *r2 = MIN(*r2, (gint)desktop->occupied_rows - 1);
+    return TRUE;
+}
+
+static void occupied_mark(FmDesktop* desktop, FmDesktopItem* item)
+{
+    gint c, r, c1, c2, r1, r2;
+    guint i;
+
+    /* it will be rebuilt from fixed_items anyway */
+    if (desktop->occupied == NULL || desktop->occupied_dirty)
+        return;
+    if (!occupied_get_range(desktop, item, &c1, &c2, &r1, &r2))
+        return;
+    for (r = r1; r <= r2; r++)
+        for (c = c1; c <= c2; c++)
+        {
+            i = r * desktop->occupied_cols + c;
+            desktop->occupied[i >> 3] |= (1 << (i & 7));
+        }
+}
+
+static void occupied_rebuild(FmDesktop* desktop)
 {
     GList* l;
-    for(l = desktop->fixed_items; l; l=l->next)
+
+    g_free(desktop->occupied);
+    desktop->occupied = NULL;
+    desktop->occupied_dirty = FALSE;
+    if (desktop->cell_w == 0 || desktop->cell_h == 0)
+        return;
+    desktop->occupied_cols = (guint)desktop->working_area.width / desktop->cell_w + 2;
+    desktop->occupied_rows = (guint)desktop->working_area.height / desktop->cell_h + 2;
+    desktop->occupied_y = desktop->working_area.y + desktop->ymargin;
+    if (gtk_widget_get_direction(GTK_WIDGET(desktop)) != GTK_TEXT_DIR_RTL)
+        desktop->occupied_x = desktop->working_area.x + desktop->xmargin;
+    else /* RTL: columns are aligned to the right edge */
+        desktop->occupied_x = desktop->working_area.x + desktop->working_area.width
+                              - desktop->xmargin
+                              - (gint)(desktop->occupied_cols * desktop->cell_w);
+    desktop->occupied = g_new0(guint8, (desktop->occupied_cols * desktop->occupied_rows + 7) / 8);
+    for (l = desktop->fixed_items; l; l = l->next)
+        occupied_mark(desktop, l->data);
+}
+
+static gboolean is_pos_occupied(FmDesktop* desktop, FmDesktopItem* item)
+{
+    GdkRectangle rect;
+    gint c, r, c1, c2, r1, r2;
+    guint i;
+
+    if (desktop->more_reserved)
     {
-        FmDesktopItem* fixed = (FmDesktopItem*)l->data;
-        GdkRectangle rect;
-        get_item_rect(fixed, &rect);
-        if(gdk_rectangle_intersect(&rect, &item->icon_rect, NULL)
-         ||gdk_rectangle_intersect(&rect, &item->text_rect, NULL))
+        get_item_rect(item, &rect);
+        if (gdk_rectangle_intersect(&rect, &desktop->more_rect, NULL))
             return TRUE;
     }
+    if (desktop->occupied == NULL || desktop->occupied_dirty)
+        occupied_rebuild(desktop);
+    if (desktop->occupied == NULL)
+        return FALSE;
+    if (!occupied_get_range(desktop, item, &c1, &c2, &r1, &r2))
+        return FALSE;
+    for (r = r1; r <= r2; r++)
+        for (c = c1; c <= c2; c++)
+        {
+            i = r * desktop->occupied_cols + c;
+            if (desktop->occupied[i >> 3] & (1 << (i & 7)))
+                return TRUE;
+        }
     return FALSE;
 }
 
-static void layout_items(FmDesktop* self)
+/* moves the item to the position without recalculating its size */
+static inline void set_item_position(FmDesktopItem* item, int x, int y)
 {
-    FmDesktopItem* item;
-    GtkTreeModel* model = self->model ? GTK_TREE_MODEL(self->model) : NULL;
-    GdkPixbuf* icon;
-    GtkTreeIter it;
-    int x, y, bottom;
-    GtkTextDirection direction = gtk_widget_get_direction(GTK_WIDGET(self));
+    int dx = x - item->area.x;
+    int dy = y - item->area.y;
+
+    item->area.x = x;
+    item->area.y = y;
+    item->icon_rect.x += dx;
+    item->icon_rect.y += dy;
+    item->text_rect.x += dx;
+    item->text_rect.y += dy;
+}
+
+/* the last cell of the last column which fits into the working area shows
+   the number of items which don't fit, see paint_more_items() */
+static void update_more_rect(FmDesktop* self)
+{
+    gint cols, rows;
+
+    cols = (self->working_area.width - self->xmargin - (gint)self->cell_w) / (gint)self->cell_w;
+    rows = (self->working_area.height - 2 * self->ymargin - (gint)self->cell_h) / (gint)self->cell_h;
+    cols = MAX(cols, 0);
+    rows = MAX(rows, 0);
+    if (gtk_widget_get_direction(GTK_WIDGET(self)) != GTK_TEXT_DIR_RTL)
+        self->more_rect.x = self->working_area.x + self->xmargin + cols * (gint)self->cell_w;
+    else
+        self->more_rect.x = self->working_area.x + self->working_area.width
+                            - self->xmargin - (cols + 1) * (gint)self->cell_w;
+    self->more_rect.y = self->working_area.y + self->ymargin + rows * (gint)self->cell_h;
+    self->more_rect.width = self->cell_w;
+    self->more_rect.height = self->cell_h;
+}
+
+static void redraw_more_items(FmDesktop* self)
+{
+    if (gtk_widget_get_realized(GTK_WIDGET(self)))
+        gdk_window_invalidate_rect(gtk_widget_get_window(GTK_WIDGET(self)),
+                                   &self->more_rect, FALSE);
+}
+
+/* TRUE if the column at layout_x is not past the column of more_rect */
+static inline gboolean is_layout_column_visible(FmDesktop* self)
+{
+    if (gtk_widget_get_direction(GTK_WIDGET(self)) != GTK_TEXT_DIR_RTL)
+        return self->layout_x <= self->more_rect.x - self->working_area.x;
+    return self->layout_x >= self->more_rect.x - self->working_area.x;
+}
 
-    y = self->ymargin;
-    bottom = self->working_area.height - self->ymargin;
+/* puts the auto-positioned item into the first free place starting from
+   (layout_x, layout_y) and advances that position for the next item;
+   if measure is FALSE then the item size is known already; if there is
+   no place on the screen then the item is hidden without measuring it */
+static void place_item(FmDesktop* self, FmDesktopItem* item, GdkPixbuf* icon,
+                       gboolean measure)
+{
+    int bottom = self->working_area.height - self->ymargin;
+    int step = self->cell_w;
 
-    if(!model || !gtk_tree_model_get_iter_first(model, &it))
+    if (gtk_widget_get_direction(GTK_WIDGET(self)) == GTK_TEXT_DIR_RTL)
+        step = -step;
+    if (!is_layout_column_visible(self))
+        goto _hide;
+    if (measure || item->hidden)
     {
-        gtk_widget_queue_draw(GTK_WIDGET(self));
-        return;
+        item->area.x = self->working_area.x + self->layout_x;
+        item->area.y = self->working_area.y + self->layout_y;
+        calc_item_size(self, item, icon);
     }
-    if(direction != GTK_TEXT_DIR_RTL) /* LTR or NONE */
-    {
-        x = self->xmargin;
-        do
-        {
-            item = fm_folder_model_get_item_userdata(self->model, &it);
-            icon = NULL;
-            gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
-            if(item->fixed_pos)
-                calc_item_size(self, item, icon);
-            else
-            {
 _next_position:
-                item->area.x = self->working_area.x + x;
-                item->area.y = self->working_area.y + y;
-                calc_item_size(self, item, icon);
-                /* check if item does not fit into space that left */
-                if (item->area.y + item->area.height > bottom && y > self->ymargin)
-                {
-                    x += self->cell_w;
-                    y = self->ymargin;
-                    goto _next_position;
-                }
-                /* prepare position for next item */
-                while (self->working_area.y + y < item->area.y + item->area.height)
-                    y += self->cell_h;
-                /* check if this position is occupied by a fixed item */
-                if(is_pos_occupied(self, item))
-                    goto _next_position;
-            }
-            if(icon)
-                g_object_unref(icon);
-        }
-        while(gtk_tree_model_iter_next(model, &it));
+    set_item_position(item, self->working_area.x + self->layout_x,
+                      self->working_area.y + self->layout_y);
+    /* check if item does not fit into space that left */
+    if (item->area.y + item->area.height > bottom && self->layout_y > self->ymargin)
+    {
+        self->layout_x += step;
+        self->layout_y = self->ymargin;
+        if (!is_layout_column_visible(self))
+            goto _hide;
+        goto _next_position;
+    }
+    /* prepare position for next item */
+    while (self->working_area.y + self->layout_y < item->area.y + item->area.height)
+        self->layout_y += self->cell_h;
+    /* check if this position is occupied by a fixed item */
+    if(is_pos_occupied(self, item))
+        goto _next_position;
+    if (item->hidden)
+    {
+        item->hidden = FALSE;
+        self->n_hidden--;
     }
-    else /* RTL */
+    return;
+
+_hide:
+    if (!item->hidden)
     {
-        x = self->working_area.width - self->xmargin - self->cell_w;
-        do
-        {
-            item = fm_folder_model_get_item_userdata(self->model, &it);
+        item->hidden = TRUE;
+        self->n_hidden++;
+    }
+    /* empty rectangles are never painted nor hit */
+    item->area.x = self->more_rect.x;
+    item->area.y = self->more_rect.y;
+    item->area.width = item->area.height = 0;
+    item->icon_rect = item->text_rect = item->area;
+    /* the label needs a place, it is reserved on the next full layout */
+    if (!self->more_reserved)
+    {
+        self->more_reserved = TRUE;
+        queue_layout_items(self);
+    }
+}
+
+static void layout_items(FmDesktop* self)
+{
+    FmDesktopItem* item;
+    GdkPixbuf* icon;
+    guint i;
+    GtkTextDirection direction = gtk_widget_get_direction(GTK_WIDGET(self));
+
+    self->layout_y = self->ymargin;
+    if(direction != GTK_TEXT_DIR_RTL) /* LTR or NONE */
+        self->layout_x = self->xmargin;
+    else /* RTL */
+        self->layout_x = self->working_area.width - self->xmargin - self->cell_w;
+    self->layout_valid = TRUE;
+    self->layout_unordered = FALSE;
+    self->n_hidden = 0;
+
+    hit_grid_reset(self);
+    occupied_rebuild(self);
+    update_more_rect(self);
+    for(i = 0; i < self->items->len; i++)
+    {
+        item = g_ptr_array_index(self->items, i);
+        item->hidden = FALSE;
+        /* the icon is needed only if the item will be measured */
+        if(item->fixed_pos || is_layout_column_visible(self))
+            icon = get_item_icon(self, item);
+        else
             icon = NULL;
-            gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
-            if(item->fixed_pos)
-                calc_item_size(self, item, icon);
-            else
-            {
-_next_position_rtl:
-                item->area.x = self->working_area.x + x;
-                item->area.y = self->working_area.y + y;
-                calc_item_size(self, item, icon);
-                /* check if item does not fit into space that left */
-                if (item->area.y + item->area.height > bottom && y > self->ymargin)
-                {
-                    x -= self->cell_w;
-                    y = self->ymargin;
-                    goto _next_position_rtl;
-                }
-                /* prepare position for next item */
-                while (self->working_area.y + y < item->area.y + item->area.height)
-                    y += self->cell_h;
-                /* check if this position is occupied by a fixed item */
-                if(is_pos_occupied(self, item))
-                    goto _next_position_rtl;
-            }
-            if(icon)
-                g_object_unref(icon);
-        }
-        while(gtk_tree_model_iter_next(model, &it));
+        if(item->fixed_pos)
+            calc_item_size(self, item, icon);
+        else
+            place_item(self, item, icon, TRUE);
+        hit_grid_add(self, item);
+        if(icon)
+            g_object_unref(icon);
     }
+    if(self->n_hidden == 0)
+        self->more_reserved = FALSE;
     gtk_widget_queue_draw(GTK_WIDGET(self));
 }
 
@@ -1836,6 +2580,12 @@ static gboolean on_idle_layout(FmDesktop* desktop)
 
 static void queue_layout_items(FmDesktop* desktop)
 {
+    /* full layout will place all items anyway */
+    if (desktop->idle_relayout)
+    {
+        g_source_remove(desktop->idle_relayout);
+        desktop->idle_relayout = 0;
+    }
     /* don't try to layout items until config is loaded,
        this may be cause of the bug #927 on SF.net */
     if (!gtk_widget_get_realized(GTK_WIDGET(desktop)))
@@ -1844,47 +2594,143 @@ static void queue_layout_items(FmDesktop* desktop)
         desktop->idle_layout = gdk_threads_add_idle((GSourceFunc)on_idle_layout, desktop);
 }
 
-static void paint_item(FmDesktop* self, FmDesktopItem* item, cairo_t* cr, GdkRectangle* expose_area, GdkPixbuf* icon)
+/* TRUE if all items are placed and no full layout is queued */
+static inline gboolean is_layout_valid(FmDesktop* desktop)
 {
-#if GTK_CHECK_VERSION(3, 0, 0)
-    GtkStyleContext* style;
-#else
-    GtkStyle* style;
-#endif
-    GtkWidget* widget = (GtkWidget*)self;
-    GtkCellRendererState state = 0;
-#if GTK_CHECK_VERSION(3, 0, 0)
-    GdkRGBA rgba;
-#else
-    GdkWindow* window;
-#endif
-    int text_x, text_y;
+    return desktop->layout_valid && !desktop->layout_pending && desktop->idle_layout == 0;
+}
 
-    /* don't draw dragged items on desktop, they are moved with mouse */
-    if (item->is_selected && self->dragging)
-        return;
+static gboolean on_idle_relayout(FmDesktop* desktop)
+{
+    FmDesktopItem* item;
+    GdkPixbuf* icon;
+    guint i;
 
-#if GTK_CHECK_VERSION(3, 0, 0)
+    desktop->idle_relayout = 0;
+    desktop->layout_x = desktop->relayout_x;
+    desktop->layout_y = desktop->relayout_y;
+    for(i = MAX(desktop->relayout_from, 0); i < desktop->items->len; i++)
+    {
+        item = g_ptr_array_index(desktop->items, i);
+        if(item->fixed_pos)
+            continue;
+        if(item->hidden && is_layout_column_visible(desktop))
+        {
+            /* it was never measured */
+            icon = get_item_icon(desktop, item);
+            place_item(desktop, item, icon, TRUE);
+            if(icon)
+                g_object_unref(icon);
+        }
+        else
+            place_item(desktop, item, NULL, FALSE);
+        hit_grid_update(desktop, item);
+    }
+    gtk_widget_queue_draw(GTK_WIDGET(desktop));
+    return FALSE;
+}
+
+/* reflows auto-positioned items starting from n-th in the model, the first
+   of them takes the place of the item which was removed from there, or the
+   first place on the desktop if removed is NULL */
+static void queue_relayout_items(FmDesktop* desktop, gint n, FmDesktopItem* removed)
+{
+    if (desktop->idle_relayout && n >= desktop->relayout_from)
+        return; /* it will be reflowed already */
+    desktop->relayout_from = n;
+    if (removed)
+    {
+        desktop->relayout_x = removed->area.x - desktop->working_area.x;
+        desktop->relayout_y = removed->area.y - desktop->working_area.y;
+    }
+    else
+    {
+        /* same as layout_items() starts from */
+        desktop->relayout_y = desktop->ymargin;
+        if (gtk_widget_get_direction(GTK_WIDGET(desktop)) != GTK_TEXT_DIR_RTL)
+            desktop->relayout_x = desktop->xmargin;
+        else
+            desktop->relayout_x = desktop->working_area.width - desktop->xmargin - desktop->cell_w;
+    }
+    if (0 == desktop->idle_relayout)
+        desktop->idle_relayout = gdk_threads_add_idle((GSourceFunc)on_idle_relayout, desktop);
+}
+
+/* TRUE if the auto-positioned item was placed before the area, i.e. in
+   a previous column or above the area in the same one */
+static gboolean is_placed_before(FmDesktop* desktop, FmDesktopItem* item, GdkRectangle* area)
+{
+    if (gtk_widget_get_direction(GTK_WIDGET(desktop)) != GTK_TEXT_DIR_RTL)
+    {
+        if (item->area.x + (gint)desktop->cell_w <= area->x)
+            return TRUE;
+        if (item->area.x >= area->x + area->width)
+            return FALSE;
+    }
+    else
+    {
+        if (item->area.x >= area->x + area->width)
+            return TRUE;
+        if (item->area.x + (gint)desktop->cell_w <= area->x)
+            return FALSE;
+    }
+    return (item->area.y + item->area.height <= area->y);
+}
+
+/* the place of the removed fixed item may be taken by the first of auto
+   items which were placed after it, reflow them starting from the last
+   item before it; n is the index the removed item had in the model */
+static void queue_relayout_freed(FmDesktop* desktop, gint n, FmDesktopItem* removed)
+{
+    FmDesktopItem* item;
+    FmDesktopItem* prev = NULL;
+    guint i, prev_n = 0;
+
+    for (i = 0; i < desktop->items->len; i++)
+    {
+        item = g_ptr_array_index(desktop->items, i);
+        if (item == removed || item->fixed_pos)
+            continue;
+        /* auto items are placed in model order, hidden ones are the last */
+        if (item->hidden || !is_placed_before(desktop, item, &removed->area))
+            break;
+        prev = item;
+        prev_n = i;
+    }
+    if (prev == NULL)
+        queue_relayout_items(desktop, 0, NULL);
+    else /* indices after the removed item will be shifted */
+        queue_relayout_items(desktop, (gint)prev_n > n ? (gint)prev_n - 1 : (gint)prev_n, prev);
+}
+
+/* draws label of the item with its background or shadow */
+static void draw_item_label(FmDesktop* self, FmDesktopItem* item, cairo_t* cr,
+                            gboolean selected)
+{
+#if GTK_CHECK_VERSION(3, 0, 0)
+    GtkStyleContext* style;
+    GdkRGBA rgba;
+#else
+    GtkStyle* style;
+#endif
+    GtkWidget* widget = (GtkWidget*)self;
+    PangoLayout* layout;
+    int text_x, text_y;
+
+#if GTK_CHECK_VERSION(3, 0, 0)
     style = gtk_widget_get_style_context(widget);
 #else
     style = gtk_widget_get_style(widget);
-    window = gtk_widget_get_window(widget);
 #endif
 
-    pango_layout_set_text(self->pl, NULL, 0);
-    pango_layout_set_width(self->pl, self->pango_text_w);
-    pango_layout_set_height(self->pl, self->pango_text_h);
-
-    pango_layout_set_text(self->pl, fm_file_info_get_disp_name(item->fi), -1);
+    layout = get_item_layout(self, item);
 
     /* FIXME: do we need to cache this? */
     text_x = item->area.x + (self->cell_w - self->text_w)/2 + 2;
     text_y = item->text_rect.y + 2;
 
-    if(item->is_selected || item == self->drop_hilight) /* draw background for text label */
+    if(selected) /* draw background for text label */
     {
-        state = GTK_CELL_RENDERER_SELECTED;
-
         cairo_save(cr);
         gdk_cairo_rectangle(cr, &item->text_rect);
 #if GTK_CHECK_VERSION(3, 0, 0)
@@ -1908,20 +2754,161 @@ static void paint_item(FmDesktop* self, FmDesktopItem* item, cairo_t* cr, GdkRec
         /* the shadow */
         gdk_cairo_set_source_color(cr, &self->conf.desktop_shadow);
         cairo_move_to(cr, text_x + 1, text_y + 1);
-        pango_cairo_show_layout(cr, self->pl);
+        pango_cairo_show_layout(cr, layout);
         gdk_cairo_set_source_color(cr, &self->conf.desktop_fg);
     }
     /* real text */
     cairo_move_to(cr, text_x, text_y);
     /* FIXME: should we check if pango is 1.10 at least? */
-    pango_cairo_show_layout(cr, self->pl);
-    pango_layout_set_text(self->pl, NULL, 0);
+    pango_cairo_show_layout(cr, layout);
+}
+
+/* draws label and icon of the item, focus is drawn by paint_item() */
+static void draw_item(FmDesktop* self, FmDesktopItem* item, cairo_t* cr,
+                      GdkRectangle* expose_area, GdkPixbuf* icon, gboolean selected)
+{
+    GtkWidget* widget = (GtkWidget*)self;
+    GtkCellRendererState state = selected ? GTK_CELL_RENDERER_SELECTED : 0;
+
+    draw_item_label(self, item, cr, selected);
+
+    /* draw the icon */
+    g_object_set(self->icon_render, "pixbuf", icon, "info", item->fi, NULL);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    gtk_cell_renderer_render(GTK_CELL_RENDERER(self->icon_render), cr, widget, &item->icon_rect, &item->icon_rect, state);
+#else
+    gtk_cell_renderer_render(GTK_CELL_RENDERER(self->icon_render), gtk_widget_get_window(widget),
+                             widget, &item->icon_rect, &item->icon_rect, expose_area, state);
+#endif
+}
+
+/* returns the item rendered in the given state into an offscreen surface,
+   both states are kept so changing selection only picks another one, they
+   are rendered again only if its label, icon or colors changed; with GTK+ 2
+   it's a pixmap with alpha, NULL if the screen has no such visual */
+#if GTK_CHECK_VERSION(3, 0, 0)
+static cairo_surface_t* get_item_surface(FmDesktop* self, FmDesktopItem* item,
+                                         gboolean selected)
+#else
+static GdkPixmap* get_item_surface(FmDesktop* self, FmDesktopItem* item,
+                                   gboolean selected)
+#endif
+{
+    GdkRectangle rect;
+    GdkPixbuf* icon;
+    cairo_t* cr;
+#if !GTK_CHECK_VERSION(3, 0, 0)
+    GdkColormap* cmap;
+    GdkRectangle icon_rect;
+#endif
+
+    selected = (selected != FALSE);
+    /* this drops the surfaces if the label has to be shaped again */
+    get_item_layout(self, item);
+    if (item->surface_serial != self->render_serial)
+    {
+        desktop_item_free_surfaces(item);
+        item->surface_serial = self->render_serial;
+    }
+    if (item->surface[selected] != NULL)
+        return item->surface[selected];
+    get_item_rect(item, &rect);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    /* add a pixel for the shadow */
+    item->surface[selected] = gdk_window_create_similar_surface(gtk_widget_get_window(GTK_WIDGET(self)),
+                                                                CAIRO_CONTENT_COLOR_ALPHA,
+                                                                rect.width + 1, rect.height + 1);
+    cr = cairo_create(item->surface[selected]);
+    cairo_translate(cr, -rect.x, -rect.y);
+    icon = get_item_icon(self, item);
+    draw_item(self, item, cr, NULL, icon, selected);
+    cairo_destroy(cr);
+#else
+    cmap = gdk_screen_get_rgba_colormap(gtk_widget_get_screen(GTK_WIDGET(self)));
+    if (cmap == NULL)
+        return NULL;
+    /* add a pixel for the shadow */
+    item->surface[selected] = gdk_pixmap_new(NULL, rect.width + 1, rect.height + 1,
+                                             gdk_colormap_get_visual(cmap)->depth);
+    gdk_drawable_set_colormap(item->surface[selected], cmap);
+    cr = gdk_cairo_create(item->surface[selected]);
+    /* new pixmap has undefined content */
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+    cairo_translate(cr, -rect.x, -rect.y);
+    draw_item_label(self, item, cr, selected);
+    cairo_destroy(cr);
+    /* the cell renderer draws onto the drawable itself */
+    icon = get_item_icon(self, item);
+    icon_rect = item->icon_rect;
+    icon_rect.x -= rect.x;
+    icon_rect.y -= rect.y;
+    g_object_set(self->icon_render, "pixbuf", icon, "info", item->fi, NULL);
+    gtk_cell_renderer_render(GTK_CELL_RENDERER(self->icon_render), item->surface[selected],
+                             GTK_WIDGET(self), &icon_rect, &icon_rect, NULL,
+                             selected ? GTK_CELL_RENDERER_SELECTED : 0);
+#endif
+    if (icon)
+        g_object_unref(icon);
+    return item->surface[selected];
+}
+
+static void paint_item(FmDesktop* self, FmDesktopItem* item, cairo_t* cr, GdkRectangle* expose_area)
+{
+#if GTK_CHECK_VERSION(3, 0, 0)
+    GtkStyleContext* style;
+    cairo_surface_t* surface;
+#else
+    GtkStyle* style;
+    GdkPixmap* surface;
+    GdkPixbuf* icon;
+#endif
+    GdkRectangle rect;
+    GtkWidget* widget = (GtkWidget*)self;
+    gboolean selected;
+
+    /* don't draw dragged items on desktop, they are moved with mouse */
+    if (item->is_selected && self->dragging)
+        return;
+
+    selected = (item->is_selected || item == self->drop_hilight);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    style = gtk_widget_get_style_context(widget);
+    surface = get_item_surface(self, item, selected);
+    get_item_rect(item, &rect);
+    cairo_save(cr);
+    cairo_set_source_surface(cr, surface, rect.x, rect.y);
+    cairo_rectangle(cr, rect.x, rect.y, rect.width + 1, rect.height + 1);
+    cairo_fill(cr);
+    cairo_restore(cr);
+#else
+    style = gtk_widget_get_style(widget);
+    surface = get_item_surface(self, item, selected);
+    if (surface)
+    {
+        get_item_rect(item, &rect);
+        cairo_save(cr);
+        gdk_cairo_set_source_pixmap(cr, surface, rect.x, rect.y);
+        cairo_rectangle(cr, rect.x, rect.y, rect.width + 1, rect.height + 1);
+        cairo_fill(cr);
+        cairo_restore(cr);
+    }
+    else
+    {
+        /* no visual with alpha, draw it directly */
+        icon = get_item_icon(self, item);
+        draw_item(self, item, cr, expose_area, icon, selected);
+        if (icon)
+            g_object_unref(icon);
+    }
+#endif
 
     if(item == self->focus && gtk_widget_has_focus(widget))
 #if GTK_CHECK_VERSION(3, 0, 0)
         gtk_render_focus(style, cr,
 #else
-        gtk_paint_focus(style, window, gtk_widget_get_state(widget),
+        gtk_paint_focus(style, gtk_widget_get_window(widget), gtk_widget_get_state(widget),
                         expose_area, widget, "icon_view",
 #endif
                         item->text_rect.x, item->text_rect.y, item->text_rect.width, item->text_rect.height);
@@ -1930,14 +2917,6 @@ static void paint_item(FmDesktop* self, FmDesktopItem* item, cairo_t* cr, GdkRec
         g_object_set(G_OBJECT(self), "tooltip-text", fm_file_info_get_disp_name(item->fi), NULL);
     else
         g_object_set(G_OBJECT(self), "tooltip-text", NULL, NULL);
-
-    /* draw the icon */
-    g_object_set(self->icon_render, "pixbuf", icon, "info", item->fi, NULL);
-#if GTK_CHECK_VERSION(3, 0, 0)
-    gtk_cell_renderer_render(GTK_CELL_RENDERER(self->icon_render), cr, widget, &item->icon_rect, &item->icon_rect, state);
-#else
-    gtk_cell_renderer_render(GTK_CELL_RENDERER(self->icon_render), window, widget, &item->icon_rect, &item->icon_rect, expose_area, state);
-#endif
 }
 
 static void redraw_item(FmDesktop* desktop, FmDesktopItem* item)
@@ -1953,7 +2932,6 @@ static void redraw_item(FmDesktop* desktop, FmDesktopItem* item)
 
 static void move_item(FmDesktop* desktop, FmDesktopItem* item, int x, int y, gboolean redraw)
 {
-    int dx, dy;
     /* this call invalid the area occupied by the item and a redraw
      * is queued. */
     if(redraw)
@@ -1969,24 +2947,20 @@ static void move_item(FmDesktop* desktop, FmDesktopItem* item, int x, int y, gbo
     if (y < desktop->working_area.y + desktop->ymargin)
         y = desktop->working_area.y + desktop->ymargin;
 
-    dx = x - item->area.x;
-    dy = y - item->area.y;
-
-    item->area.x = x;
-    item->area.y = y;
-
+    hit_grid_remove(desktop, item);
     /* calc_item_size(desktop, item); */
-    item->icon_rect.x += dx;
-    item->icon_rect.y += dy;
-    item->text_rect.x += dx;
-    item->text_rect.y += dy;
+    set_item_position(item, x, y);
+    hit_grid_add(desktop, item);
 
     /* make the item use customized fixed position. */
     if(!item->fixed_pos)
     {
         item->fixed_pos = TRUE;
         desktop->fixed_items = g_list_prepend(desktop->fixed_items, item);
+        occupied_mark(desktop, item);
     }
+    else /* cells it left may be free now */
+        desktop->occupied_dirty = TRUE;
 
     /* move the item to a new place, and queue a redraw for the new rect. */
     if(redraw)
@@ -2026,35 +3000,33 @@ static void calc_rubber_banding_rect(FmDesktop* self, int x, int y, GdkRectangle
 
 static void update_rubberbanding(FmDesktop* self, int newx, int newy)
 {
-    GtkTreeModel* model = self->model ? GTK_TREE_MODEL(self->model) : NULL;
-    GtkTreeIter it;
-    GdkRectangle old_rect, new_rect;
-    //GdkRegion *region;
-    GdkWindow *window;
-
-    window = gtk_widget_get_window(GTK_WIDGET(self));
+    guint i;
+    GdkRectangle old_rect, new_rect, rect;
+#if GTK_CHECK_VERSION(3, 0, 0)
+    cairo_region_t *region;
+#else
+    GdkRegion *region;
+#endif
+    GSList *changed = NULL;
 
     calc_rubber_banding_rect(self, self->rubber_bending_x, self->rubber_bending_y, &old_rect);
     calc_rubber_banding_rect(self, newx, newy, &new_rect);
 
-    gdk_window_invalidate_rect(window, &old_rect, FALSE);
-    gdk_window_invalidate_rect(window, &new_rect, FALSE);
-//    gdk_window_clear_area(((GtkWidget*)self)->window, new_rect.x, new_rect.y, new_rect.width, new_rect.height);
-/*
+    /* collect all damage so the window is invalidated only once */
+#if GTK_CHECK_VERSION(3, 0, 0)
+    region = cairo_region_create_rectangle(&old_rect);
+    cairo_region_union_rectangle(region, &new_rect);
+#else
     region = gdk_region_rectangle(&old_rect);
     gdk_region_union_with_rect(region, &new_rect);
-
-//    gdk_window_invalidate_region(((GtkWidget*)self)->window, &region, TRUE);
-
-    gdk_region_destroy(region);
-*/
+#endif
     self->rubber_bending_x = newx;
     self->rubber_bending_y = newy;
 
     /* update selection */
-    if(model && gtk_tree_model_get_iter_first(model, &it)) do
+    for(i = 0; i < self->items->len; i++)
     {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(self->model, &it);
+        FmDesktopItem* item = g_ptr_array_index(self->items, i);
         gboolean selected;
         if(gdk_rectangle_intersect(&new_rect, &item->icon_rect, NULL) ||
             gdk_rectangle_intersect(&new_rect, &item->text_rect, NULL))
@@ -2067,12 +3039,83 @@ static void update_rubberbanding(FmDesktop* self, int newx, int newy)
             (!item->is_rubber_banded && selected))
         {
             item->is_selected = selected;
-            redraw_item(self, item);
-            fm_desktop_item_selected_changed(self, item);
+            /* same area as redraw_item() does */
+            get_item_rect(item, &rect);
+            --rect.x;
+            --rect.y;
+            rect.width += 2;
+            rect.height += 2;
+#if GTK_CHECK_VERSION(3, 0, 0)
+            cairo_region_union_rectangle(region, &rect);
+#else
+            gdk_region_union_with_rect(region, &rect);
+#endif
+            changed = g_slist_prepend(changed, item);
         }
         item->is_rubber_banded = self->rubber_bending && selected;
     }
-    while(gtk_tree_model_iter_next(model, &it));
+    gdk_window_invalidate_region(gtk_widget_get_window(GTK_WIDGET(self)), region, FALSE);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    cairo_region_destroy(region);
+#else
+    gdk_region_destroy(region);
+#endif
+    fm_desktop_items_selection_changed(self, changed);
+    g_slist_free(changed);
+}
+
+/* motion events may come much more often than the screen is refreshed so
+   rubberband is updated only once per frame to the last pointer position */
+#if GTK_CHECK_VERSION(3, 8, 0)
+static gboolean on_rubberbanding_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer unused)
+{
+    FmDesktop *self = FM_DESKTOP(widget);
+
+    self->rubber_bending_update = 0;
+    update_rubberbanding(self, self->rubber_bending_new_x, self->rubber_bending_new_y);
+    return FALSE;
+}
+#else
+static gboolean on_rubberbanding_idle(gpointer user_data)
+{
+    FmDesktop *self = user_data;
+
+    if (g_source_is_destroyed(g_main_current_source()))
+        return FALSE;
+    self->rubber_bending_update = 0;
+    update_rubberbanding(self, self->rubber_bending_new_x, self->rubber_bending_new_y);
+    return FALSE;
+}
+#endif
+
+static void queue_update_rubberbanding(FmDesktop *self, int newx, int newy)
+{
+    self->rubber_bending_new_x = newx;
+    self->rubber_bending_new_y = newy;
+    if (self->rubber_bending_update)
+        return;
+#if GTK_CHECK_VERSION(3, 8, 0)
+    self->rubber_bending_update = gtk_widget_add_tick_callback(GTK_WIDGET(self),
+                                                               on_rubberbanding_tick,
+                                                               NULL, NULL);
+#else
+    /* it should run after all pending motion events but before redraw */
+    self->rubber_bending_update = gdk_threads_add_idle_full(G_PRIORITY_HIGH_IDLE,
+                                                            on_rubberbanding_idle,
+                                                            self, NULL);
+#endif
+}
+
+static void cancel_update_rubberbanding(FmDesktop *self)
+{
+    if (self->rubber_bending_update == 0)
+        return;
+#if GTK_CHECK_VERSION(3, 8, 0)
+    gtk_widget_remove_tick_callback(GTK_WIDGET(self), self->rubber_bending_update);
+#else
+    g_source_remove(self->rubber_bending_update);
+#endif
+    self->rubber_bending_update = 0;
 }
 
 
@@ -2110,7 +3153,42 @@ static void paint_rubber_banding_rect(FmDesktop* self, cairo_t* cr, GdkRectangle
     cairo_restore(cr);
 }
 
-static void _free_cache_image(FmBackgroundCache *cache)
+/* draws the label which opens the folder with items which didn't fit */
+static void paint_more_items(FmDesktop* self, cairo_t* cr)
+{
+    PangoLayout* layout;
+    PangoAttrList* attrs;
+    char* text;
+    int text_x, text_y, text_h;
+
+    text = g_strdup_printf(ngettext("%u more item…", "%u more items…", self->n_hidden),
+                           self->n_hidden);
+    layout = pango_layout_copy(self->pl);
+    pango_layout_set_width(layout, self->pango_text_w);
+    pango_layout_set_height(layout, self->pango_text_h);
+    pango_layout_set_text(layout, text, -1);
+    attrs = pango_attr_list_new();
+    pango_attr_list_insert(attrs, pango_attr_underline_new(PANGO_UNDERLINE_SINGLE));
+    pango_layout_set_attributes(layout, attrs);
+    pango_attr_list_unref(attrs);
+    pango_layout_get_pixel_size(layout, NULL, &text_h);
+    text_x = self->more_rect.x + (self->cell_w - self->text_w) / 2 + 2;
+    text_y = self->more_rect.y + (self->more_rect.height - text_h) / 2;
+    gdk_cairo_set_source_color(cr, &self->conf.desktop_shadow);
+    cairo_move_to(cr, text_x + 1, text_y + 1);
+    pango_cairo_show_layout(cr, layout);
+    gdk_cairo_set_source_color(cr, &self->conf.desktop_fg);
+    cairo_move_to(cr, text_x, text_y);
+    pango_cairo_show_layout(cr, layout);
+    g_object_unref(layout);
+    g_free(text);
+}
+
+/* all cached wallpapers, most recently shown first */
+static FmBackgroundCache *bg_cache = NULL;
+static gsize bg_cache_size = 0;
+
+static void _free_bg_cache(FmBackgroundCache *cache)
 {
 #if GTK_CHECK_VERSION(3, 0, 0)
 #ifdef HAVE_X11
@@ -2122,90 +3200,1748 @@ static void _free_cache_image(FmBackgroundCache *cache)
 #else
     g_object_unref(cache->bg);
 #endif
-    cache->bg = NULL;
-    cache->wallpaper_mode = FM_WP_COLOR; /* for cache check */
+    _unref_wallpaper_file(cache->file);
+    g_free(cache->filename);
+    g_slice_free(FmBackgroundCache, cache);
 }
 
-static void _clear_bg_cache(FmDesktop *self)
+static void _clear_bg_cache(void)
 {
-    while(self->cache)
+    while(bg_cache)
     {
-        FmBackgroundCache *bg = self->cache;
+        FmBackgroundCache *bg = bg_cache;
 
-        self->cache = bg->next;
-        _free_cache_image(bg);
-        g_free(bg->filename);
-        g_free(bg);
+        bg_cache = bg->next;
+        _free_bg_cache(bg);
     }
+    bg_cache_size = 0;
 }
 
-static void update_background(FmDesktop* desktop, int is_it)
+/* returns limit of the memory used by bg_cache in bytes */
+static inline gsize _wallpaper_cache_limit(void)
+{
+    return (gsize)MAX(app_config->wallpaper_cache_size, 0) << 20;
+}
+
+/* logs the cache contents, called after each change of them */
+static void _dump_bg_cache(void)
 {
-    GtkWidget* widget;
-    if(IS_X11())
-        widget = (GtkWidget*)desktop;
-#ifdef HAVE_WAYLAND
-    else
-        widget = (GtkWidget*)desktop->wallpaper_window;
-#endif
-    GdkPixbuf* pix, *scaled;
-    cairo_t* cr;
-    GdkScreen *screen = gtk_widget_get_screen(widget);
-    GdkWindow* root = gdk_screen_get_root_window(screen);
-    GdkWindow *window = gtk_widget_get_window(widget);
     FmBackgroundCache *cache;
-#if GTK_CHECK_VERSION(3, 0, 0)
-    cairo_pattern_t *pattern;
-#endif
 
-#ifdef HAVE_X11
-    Display* xdisplay;
-    Pixmap xpixmap;
-    Window xroot;
-#endif
-    int screen_num = gdk_screen_get_number(screen);
+    g_debug("wallpaper cache: %lu KiB used, limit is %d MiB",
+            (gulong)(bg_cache_size / 1024), app_config->wallpaper_cache_size);
+    for(cache = bg_cache; cache; cache = cache->next)
+        g_debug("  %s (mode %d, %dx%d%+d%+d): %lu KiB, shown %u time(s)",
+                cache->filename, cache->wallpaper_mode, cache->dest_w,
+                cache->dest_h, cache->x, cache->y,
+                (gulong)(cache->size / 1024), cache->shown);
+}
 
-    char *wallpaper;
+/* drops least recently shown images until the cache fits into the limit,
+   images which are shown on some desktop now are never dropped */
+static void _trim_bg_cache(void)
+{
+    gsize limit = _wallpaper_cache_limit();
+    FmBackgroundCache *cache, **prev, **last;
+    gboolean changed = FALSE;
 
-    if (!desktop->conf.wallpaper_common)
+    while(bg_cache_size > limit)
     {
-        guint32 cur_desktop = desktop->cur_desktop;
+        last = NULL;
+        for(prev = &bg_cache; *prev; prev = &(*prev)->next)
+            if((*prev)->shown == 0)
+                last = prev;
+        if(!last)
+            break;
+        cache = *last;
+        *last = cache->next;
+        bg_cache_size -= cache->size;
+        g_debug("wallpaper cache: dropping %s", cache->filename);
+        _free_bg_cache(cache);
+        changed = TRUE;
+    }
+    if(changed)
+        _dump_bg_cache();
+}
 
-        if(is_it >= 0) /* signal "changed::wallpaper" */
-        {
-            int i;
+/* wallpaper image is composed in a thread pool, see update_background() */
+struct _FmBackgroundJob
+{
+    FmDesktop *desktop;
+    GCancellable *cancellable;
+    char *filename;
+    FmWallpaperFile *file; /* referenced */
+    time_t mtime; /* 0 if the file was not queried yet */
+    goffset fsize;
+    time_t file_mtime; /* the same as seen by the loader thread */
+    goffset file_size;
+    GdkScreen *screen;
+    FmWallpaperMode wallpaper_mode;
+    GdkColor desktop_bg;
+    int dest_w, dest_h; /* ignored for FM_WP_TILE */
+    int x, y;
+    int src_w, src_h; /* image size in the file, set by the loader */
+    gsize disk_cache_limit; /* total size of the cache on disk, in bytes */
+    gboolean prefetch; /* image is not shown when ready */
+    cairo_surface_t *image; /* the result, NULL if file cannot be loaded */
+};
 
-            wallpaper = desktop->conf.wallpaper;
-            if((gint)cur_desktop >= desktop->conf.wallpapers_configured)
+static GThreadPool *bg_pool = NULL;
+
+static inline GtkWidget *_get_bg_widget(FmDesktop *desktop)
+{
+#ifdef HAVE_WAYLAND
+    if(!IS_X11())
+        return (GtkWidget*)desktop->wallpaper_window;
+#endif
+    return (GtkWidget*)desktop;
+}
+
+static void _bg_job_free(FmBackgroundJob *job)
+{
+    if(job->image)
+        cairo_surface_destroy(job->image);
+    if(job->cancellable)
+        g_object_unref(job->cancellable);
+    if(job->desktop)
+        g_object_unref(job->desktop);
+    _unref_wallpaper_file(job->file);
+    g_free(job->filename);
+    g_slice_free(FmBackgroundJob, job);
+}
+
+static void _bg_job_cancel(FmDesktop *desktop)
+{
+    FmBackgroundJob *job = desktop->bg_job;
+    FmDesktop *other;
+    int i;
+
+    if(desktop->bg_wait)
+    {
+        _bg_job_free(desktop->bg_wait);
+        desktop->bg_wait = NULL;
+    }
+    if(job)
+    {
+        /* the job will be freed by _bg_job_finished() */
+        g_cancellable_cancel(job->cancellable);
+        desktop->bg_job = NULL;
+        /* let another desktop which waits for the same image do the job */
+        for(i = 0; i < n_screens; i++)
+        {
+            other = desktops[i];
+            if(other && other->bg_wait && _bg_job_equal(other->bg_wait, job))
             {
-                desktop->conf.wallpapers = g_renew(char *, desktop->conf.wallpapers, cur_desktop + 1);
-                /* fill the gap with current wallpaper */
-                for(i = MAX(desktop->conf.wallpapers_configured,0); i < (int)cur_desktop; i++)
-                    desktop->conf.wallpapers[i] = g_strdup(wallpaper);
-                desktop->conf.wallpapers[cur_desktop] = NULL;
-                desktop->conf.wallpapers_configured = cur_desktop + 1;
+                other->bg_job = other->bg_wait;
+                other->bg_wait = NULL;
+                _bg_job_start(other, other->bg_job);
+                break;
             }
-            /* free old image if it's not used anymore */
-            else if (g_strcmp0(desktop->conf.wallpapers[cur_desktop], wallpaper))
-            {
-                wallpaper = desktop->conf.wallpapers[cur_desktop];
-                if (wallpaper)
-                {
-                    for (i = 0; i < desktop->conf.wallpapers_configured; i++)
-                        if (i != (int)cur_desktop && /* test if it's used */
-                            g_strcmp0(desktop->conf.wallpapers[i], wallpaper) == 0)
-                            break;
-                    if (i == desktop->conf.wallpapers_configured) /* no matches */
-                    {
-                        for (cache = desktop->cache; cache; cache = cache->next)
-                            if (strcmp(wallpaper, cache->filename) == 0)
-                                break;
-                        if (cache)
-                            _free_cache_image(cache);
-                    }
-                    g_free(wallpaper);
+        }
+    }
+}
+
+static void _prefetch_cancel(FmDesktop *desktop)
+{
+    if(desktop->idle_prefetch)
+    {
+        g_source_remove(desktop->idle_prefetch);
+        desktop->idle_prefetch = 0;
+    }
+    if(desktop->prefetch_job)
+    {
+        g_cancellable_cancel(desktop->prefetch_job->cancellable);
+        desktop->prefetch_job = NULL;
+    }
+    if(desktop->prefetch_wait)
+    {
+        _unref_wallpaper_file(desktop->prefetch_wait);
+        desktop->prefetch_wait = NULL;
+    }
+}
+
+/* calculates size which the image of src_w x src_h should be scaled to */
+static void _get_wallpaper_size(FmBackgroundJob *job, int src_w, int src_h,
+                                int *width, int *height)
+{
+    switch(job->wallpaper_mode)
+    {
+    case FM_WP_STRETCH:
+    case FM_WP_SCREEN:
+        src_w = job->dest_w;
+        src_h = job->dest_h;
+        break;
+    case FM_WP_FIT:
+    case FM_WP_CROP:
+        if(job->dest_w != src_w || job->dest_h != src_h)
+        {
+            gdouble w_ratio = (float)job->dest_w / src_w;
+            gdouble h_ratio = (float)job->dest_h / src_h;
+            gdouble ratio = (job->wallpaper_mode == FM_WP_FIT)
+                ? MIN(w_ratio, h_ratio)
+                : MAX(w_ratio, h_ratio);
+            if(ratio != 1.0)
+            {
+                src_w = MAX(src_w * ratio, 1);
+                src_h = MAX(src_h * ratio, 1);
+            }
+        }
+        break;
+    case FM_WP_TILE:
+    case FM_WP_CENTER:
+    case FM_WP_COLOR: ;
+    }
+    *width = src_w;
+    *height = src_h;
+}
+
+static void on_wallpaper_size_prepared(GdkPixbufLoader *loader, gint width,
+                                       gint height, FmBackgroundJob *job)
+{
+    int w, h, k;
+
+    job->src_w = width;
+    job->src_h = height;
+    _get_wallpaper_size(job, width, height, &w, &h);
+    /* let loader decode it reduced by 1/2, 1/4 or 1/8 which JPEG loader does
+       exactly on DCT stage, the rest is done by fm_wallpaper_scale() which
+       gives better quality than the loader would do */
+    for(k = 8; k > 1; k /= 2)
+        if((width + k - 1) / k >= w && (height + k - 1) / k >= h)
+            break;
+    if(k > 1)
+        gdk_pixbuf_loader_set_size(loader, (width + k - 1) / k, (height + k - 1) / k);
+}
+
+/* loads the image reduced to the smallest size which still covers needed
+   area so full size image is never allocated */
+static GdkPixbuf *_load_wallpaper(FmBackgroundJob *job)
+{
+    GdkPixbufLoader *loader;
+    GdkPixbuf *pix = NULL;
+    FILE *f;
+    guchar *buf;
+    size_t len;
+    gboolean ok = TRUE;
+
+    f = fopen(job->filename, "rb");
+    if(!f)
+        return NULL;
+    loader = gdk_pixbuf_loader_new();
+    g_signal_connect(loader, "size-prepared",
+                     G_CALLBACK(on_wallpaper_size_prepared), job);
+    buf = g_malloc(65536);
+    while((len = fread(buf, 1, 65536, f)) > 0)
+        if(g_cancellable_is_cancelled(job->cancellable)
+           || !gdk_pixbuf_loader_write(loader, buf, len, NULL))
+        {
+            ok = FALSE;
+            break;
+        }
+    if(ferror(f))
+        ok = FALSE;
+    g_free(buf);
+    fclose(f);
+    /* loader should be closed anyway */
+    if(gdk_pixbuf_loader_close(loader, NULL) && ok)
+        pix = gdk_pixbuf_loader_get_pixbuf(loader);
+    if(pix)
+        g_object_ref(pix);
+    g_object_unref(loader);
+    return pix;
+}
+
+/* this is called in a worker thread so should not touch GDK */
+static cairo_surface_t *_compose_wallpaper(FmBackgroundJob *job)
+{
+    GdkPixbuf *pix, *scaled;
+    cairo_surface_t *image;
+    cairo_t *cr;
+    int src_w, src_h; /* decoded image */
+    int canvas_w, canvas_h; /* composed wallpaper */
+    int img_w, img_h; /* image scaled for the mode */
+    int x = job->x, y = job->y;
+
+    pix = _load_wallpaper(job);
+    if(!pix)
+        return NULL;
+    if(g_cancellable_is_cancelled(job->cancellable))
+    {
+        g_object_unref(pix);
+        return NULL;
+    }
+    src_w = gdk_pixbuf_get_width(pix);
+    src_h = gdk_pixbuf_get_height(pix);
+    if(src_w != job->src_w || src_h != job->src_h)
+        g_debug("wallpaper %s decoded at %dx%d instead of %dx%d, %lu KiB saved",
+                job->filename, src_w, src_h, job->src_w, job->src_h,
+                (gulong)(((gint64)job->src_w * job->src_h - (gint64)src_w * src_h)
+                         * gdk_pixbuf_get_n_channels(pix) / 1024));
+    if(job->wallpaper_mode == FM_WP_TILE)
+    {
+        canvas_w = src_w;
+        canvas_h = src_h;
+    }
+    else
+    {
+        canvas_w = job->dest_w;
+        canvas_h = job->dest_h;
+    }
+    image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, canvas_w, canvas_h);
+    cr = cairo_create(image);
+    if(gdk_pixbuf_get_has_alpha(pix)
+        || job->wallpaper_mode == FM_WP_CENTER
+        || job->wallpaper_mode == FM_WP_FIT)
+    {
+        gdk_cairo_set_source_color(cr, &job->desktop_bg);
+        cairo_rectangle(cr, 0, 0, canvas_w, canvas_h);
+        cairo_fill(cr);
+    }
+
+    /* the loader might do the scaling already, finish it if it did not */
+    _get_wallpaper_size(job, job->src_w, job->src_h, &img_w, &img_h);
+    if(img_w != src_w || img_h != src_h)
+    {
+        scaled = fm_wallpaper_scale(pix, img_w, img_h);
+        g_object_unref(pix);
+        pix = scaled;
+    }
+    switch(job->wallpaper_mode)
+    {
+    case FM_WP_FIT:
+    case FM_WP_CROP:
+    case FM_WP_CENTER:
+        x = (canvas_w - img_w)/2;
+        y = (canvas_h - img_h)/2;
+        break;
+    case FM_WP_TILE:
+    case FM_WP_STRETCH:
+    case FM_WP_SCREEN:
+    case FM_WP_COLOR: ; /* handled in update_background() */
+    }
+    if(pix && !g_cancellable_is_cancelled(job->cancellable))
+    {
+        gdk_cairo_set_source_pixbuf(cr, pix, x, y);
+        cairo_paint(cr);
+    }
+    cairo_destroy(cr);
+    if(!pix) /* out of memory on scaling */
+    {
+        cairo_surface_destroy(image);
+        return NULL;
+    }
+    g_object_unref(pix);
+    return image;
+}
+
+/* composed wallpapers are stored on disk so they can be shown at next start
+   without decoding the file; each file has 16-byte header (see below) and
+   then ARGB32 pixel data which can be mapped into memory directly */
+#define WALLPAPER_CACHE_MAGIC "PCMFMWP1"
+#define WALLPAPER_CACHE_HEADER 16
+#define WALLPAPER_CACHE_MAX_FILES 32
+/* temporary files, older ones are leftovers of a crash */
+#define WALLPAPER_CACHE_TMP_PREFIX "tmp-"
+#define WALLPAPER_CACHE_TMP_MAX_AGE 3600
+
+typedef struct
+{
+    char magic[8];
+    guint16 width;
+    guint16 height;
+    guint32 stride;
+} FmWallpaperCacheHeader;
+
+static char *_get_wallpaper_cache_path(FmBackgroundJob *job)
+{
+    char *key, *sum, *path;
+
+    /* byte order is in the key since pixels are stored in native one */
+    key = g_strdup_printf("%s\n%ld\n%" G_GINT64_FORMAT "\n%d\n%dx%d%+d%+d\n%04x%04x%04x\n%d",
+                          job->filename, (long)job->file_mtime, (gint64)job->file_size,
+                          job->wallpaper_mode, job->dest_w, job->dest_h,
+                          job->x, job->y, job->desktop_bg.red,
+                          job->desktop_bg.green, job->desktop_bg.blue,
+                          G_BYTE_ORDER);
+    sum = g_compute_checksum_for_string(G_CHECKSUM_MD5, key, -1);
+    path = g_build_filename(g_get_user_cache_dir(), "pcmanfm", "wallpapers", sum, NULL);
+    g_free(sum);
+    g_free(key);
+    return path;
+}
+
+static void _unmap_cached_wallpaper(gpointer mf)
+{
+    g_mapped_file_unref(mf);
+}
+
+static const cairo_user_data_key_t wallpaper_cache_key;
+
+static cairo_surface_t *_load_cached_wallpaper(FmBackgroundJob *job, const char *path)
+{
+    GMappedFile *mf;
+    FmWallpaperCacheHeader hdr;
+    cairo_surface_t *image;
+    char *data;
+    gsize len;
+
+    mf = g_mapped_file_new(path, FALSE, NULL);
+    if(!mf)
+        return NULL;
+    data = g_mapped_file_get_contents(mf);
+    len = g_mapped_file_get_length(mf);
+    if(len < WALLPAPER_CACHE_HEADER)
+        goto _invalid;
+    memcpy(&hdr, data, sizeof(hdr));
+    if(memcmp(hdr.magic, WALLPAPER_CACHE_MAGIC, sizeof(hdr.magic)) != 0
+       || hdr.width == 0 || hdr.height == 0
+       || (int)hdr.stride != cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, hdr.width)
+       || len < WALLPAPER_CACHE_HEADER + (gsize)hdr.stride * hdr.height
+       || (job->wallpaper_mode != FM_WP_TILE &&
+           (hdr.width != job->dest_w || hdr.height != job->dest_h)))
+        goto _invalid;
+    /* the surface is only used as a source so it is never written into */
+    image = cairo_image_surface_create_for_data((guchar*)data + WALLPAPER_CACHE_HEADER,
+                                                CAIRO_FORMAT_ARGB32, hdr.width,
+                                                hdr.height, hdr.stride);
+    if(cairo_surface_set_user_data(image, &wallpaper_cache_key, mf,
+                                   _unmap_cached_wallpaper) != CAIRO_STATUS_SUCCESS)
+    {
+        cairo_surface_destroy(image);
+        goto _invalid;
+    }
+    /* update mtime so it will be not pruned soon, see _save_cached_wallpaper() */
+    utime(path, NULL);
+    g_debug("wallpaper %s loaded from cache %s", job->filename, path);
+    return image;
+
+_invalid:
+    g_mapped_file_unref(mf);
+    return NULL;
+}
+
+typedef struct
+{
+    time_t mtime;
+    goffset size;
+    char *path;
+} FmWallpaperCacheFile;
+
+static gint _compare_mtime(gconstpointer a, gconstpointer b)
+{
+    const FmWallpaperCacheFile *fa = *(FmWallpaperCacheFile * const *)a;
+    const FmWallpaperCacheFile *fb = *(FmWallpaperCacheFile * const *)b;
+
+    if(fa->mtime == fb->mtime)
+        return 0;
+    return (fa->mtime > fb->mtime) ? -1 : 1;
+}
+
+/* leaves only most recently used files which fit into @limit bytes but no
+   more than WALLPAPER_CACHE_MAX_FILES, the newest one is kept in any case */
+static void _prune_wallpaper_cache(const char *dir_path, gsize limit)
+{
+    GDir *dir = g_dir_open(dir_path, 0, NULL);
+    GPtrArray *files;
+    FmWallpaperCacheFile *file;
+    const char *name;
+    struct stat st;
+    goffset total = 0;
+    time_t now = time(NULL);
+    guint i;
+
+    if(!dir)
+        return;
+    files = g_ptr_array_new();
+    while((name = g_dir_read_name(dir)) != NULL)
+    {
+        char *path = g_build_filename(dir_path, name, NULL);
+
+        if(stat(path, &st) != 0)
+            g_free(path);
+        else if(g_str_has_prefix(name, WALLPAPER_CACHE_TMP_PREFIX))
+        {
+            /* it may be written by another thread right now */
+            if(now - st.st_mtime > WALLPAPER_CACHE_TMP_MAX_AGE)
+                g_unlink(path);
+            g_free(path);
+        }
+        else
+        {
+            file = g_slice_new(FmWallpaperCacheFile);
+            file->path = path;
+            file->mtime = st.st_mtime;
+            file->size = st.st_size;
+            total += st.st_size;
+            g_ptr_array_add(files, file);
+        }
+    }
+    g_dir_close(dir);
+    if(files->len > WALLPAPER_CACHE_MAX_FILES || total > (goffset)limit)
+        g_ptr_array_sort(files, _compare_mtime);
+    total = 0;
+    for(i = 0; i < files->len; i++)
+    {
+        file = g_ptr_array_index(files, i);
+        total += file->size;
+        if(i > 0 && (i >= WALLPAPER_CACHE_MAX_FILES || total > (goffset)limit))
+            g_unlink(file->path);
+        g_free(file->path);
+        g_slice_free(FmWallpaperCacheFile, file);
+    }
+    g_ptr_array_free(files, TRUE);
+}
+
+static void _save_cached_wallpaper(cairo_surface_t *image, const char *path,
+                                   gsize limit)
+{
+    FmWallpaperCacheHeader hdr;
+    char *dir_path, *tmp_path;
+    FILE *f;
+    int fd, height;
+    gboolean ok;
+
+    cairo_surface_flush(image);
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, WALLPAPER_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.width = cairo_image_surface_get_width(image);
+    hdr.height = height = cairo_image_surface_get_height(image);
+    hdr.stride = cairo_image_surface_get_stride(image);
+    if(hdr.width != cairo_image_surface_get_width(image) || hdr.height != height
+       || WALLPAPER_CACHE_HEADER + (gsize)hdr.stride * height > limit)
+        return; /* too big to be cached */
+    dir_path = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir_path, 0700);
+    /* write into temporary file so nobody can map incomplete one, the name
+       is unique since another thread may write the same wallpaper */
+    tmp_path = g_build_filename(dir_path, WALLPAPER_CACHE_TMP_PREFIX "XXXXXX", NULL);
+    fd = g_mkstemp(tmp_path);
+    f = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+    if(f)
+    {
+        ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(cairo_image_surface_get_data(image), hdr.stride, height, f) == (size_t)height);
+        if(fclose(f) != 0)
+            ok = FALSE;
+        if(!ok || g_rename(tmp_path, path) != 0)
+            g_unlink(tmp_path);
+        else
+            _prune_wallpaper_cache(dir_path, limit);
+    }
+    else if(fd >= 0)
+    {
+        close(fd);
+        g_unlink(tmp_path);
+    }
+    g_free(tmp_path);
+    g_free(dir_path);
+}
+
+static void _bg_job_run(gpointer data, gpointer user_data)
+{
+    FmBackgroundJob *job = data;
+    char *cache_path;
+    struct stat st;
+
+    if(!g_cancellable_is_cancelled(job->cancellable))
+    {
+        job->file_mtime = job->mtime;
+        job->file_size = job->fsize;
+        /* the file was not queried yet, see _new_wallpaper_file() */
+        if(job->mtime == 0 && stat(job->filename, &st) == 0)
+        {
+            job->file_mtime = st.st_mtime;
+            job->file_size = st.st_size;
+        }
+        cache_path = _get_wallpaper_cache_path(job);
+        job->image = _load_cached_wallpaper(job, cache_path);
+        if(!job->image)
+        {
+            job->image = _compose_wallpaper(job);
+            if(job->image && !g_cancellable_is_cancelled(job->cancellable))
+                _save_cached_wallpaper(job->image, cache_path,
+                                       job->disk_cache_limit);
+        }
+        g_free(cache_path);
+    }
+    gdk_threads_add_idle(_bg_job_finished, job);
+}
+
+#ifdef HAVE_XSHM
+/* copies image into drawable through shared memory so pixels don't go over
+   the X connection, returns FALSE if MIT-SHM cannot be used for it */
+static gboolean _upload_bg_image_shm(Display *xdisplay, Drawable drawable,
+                                     Visual *visual, int depth,
+                                     cairo_surface_t *image)
+{
+    XShmSegmentInfo shminfo;
+    XImage *ximage;
+    GC gc;
+    int width = cairo_image_surface_get_width(image);
+    int height = cairo_image_surface_get_height(image);
+    int stride = cairo_image_surface_get_stride(image);
+    const guchar *data;
+    Bool attached;
+    int y;
+
+    /* pixels of ARGB32 image can be copied only if layout is the same */
+    if((depth != 24 && depth != 32) || visual->red_mask != 0xff0000
+       || visual->green_mask != 0xff00 || visual->blue_mask != 0xff
+       || !XShmQueryExtension(xdisplay))
+        return FALSE;
+    ximage = XShmCreateImage(xdisplay, visual, depth, ZPixmap, NULL, &shminfo,
+                             width, height);
+    if(!ximage)
+        return FALSE;
+    if(ximage->bits_per_pixel != 32 ||
+       ximage->byte_order != ((G_BYTE_ORDER == G_LITTLE_ENDIAN) ? LSBFirst : MSBFirst))
+    {
+        XDestroyImage(ximage);
+        return FALSE;
+    }
+    shminfo.shmid = shmget(IPC_PRIVATE, (size_t)ximage->bytes_per_line * height,
+                           IPC_CREAT | 0600);
+    if(shminfo.shmid < 0)
+    {
+        XDestroyImage(ximage);
+        return FALSE;
+    }
+    shminfo.shmaddr = ximage->data = shmat(shminfo.shmid, NULL, 0);
+    /* the segment is destroyed as soon as both sides detach it */
+    shmctl(shminfo.shmid, IPC_RMID, NULL);
+    if(shminfo.shmaddr == (char*)-1)
+    {
+        ximage->data = NULL;
+        XDestroyImage(ximage);
+        return FALSE;
+    }
+    shminfo.readOnly = True;
+    /* attaching fails if the server is remote */
+    gdk_error_trap_push();
+    attached = XShmAttach(xdisplay, &shminfo);
+    XSync(xdisplay, False);
+    if(gdk_error_trap_pop() != 0 || !attached)
+    {
+        shmdt(shminfo.shmaddr);
+        ximage->data = NULL;
+        XDestroyImage(ximage);
+        return FALSE;
+    }
+    cairo_surface_flush(image);
+    data = cairo_image_surface_get_data(image);
+    for(y = 0; y < height; y++)
+        memcpy(ximage->data + (gsize)y * ximage->bytes_per_line,
+               data + (gsize)y * stride, (gsize)width * 4);
+    gc = XCreateGC(xdisplay, drawable, 0, NULL);
+    XShmPutImage(xdisplay, drawable, gc, ximage, 0, 0, 0, 0, width, height, False);
+    /* wait until the server has read the segment */
+    XSync(xdisplay, False);
+    XFreeGC(xdisplay, gc);
+    XShmDetach(xdisplay, &shminfo);
+    shmdt(shminfo.shmaddr);
+    ximage->data = NULL;
+    XDestroyImage(ximage);
+    return TRUE;
+}
+#endif
+
+/* copies composed image into drawable which can be used as background */
+static void _upload_bg_image(FmDesktop *desktop, FmBackgroundCache *cache,
+                             cairo_surface_t *image)
+{
+    GtkWidget *widget = _get_bg_widget(desktop);
+    int dest_w = cairo_image_surface_get_width(image);
+    int dest_h = cairo_image_surface_get_height(image);
+    cairo_t *cr;
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+    if(IS_X11())
+    {
+#ifdef HAVE_X11
+        GdkScreen *screen = gtk_widget_get_screen(widget);
+        int screen_num = gdk_screen_get_number(screen);
+        Display* xdisplay;
+        Pixmap xpixmap;
+
+        xdisplay = GDK_WINDOW_XDISPLAY(gdk_screen_get_root_window(screen));
+        /* this code is taken from libgnome-desktop */
+        xpixmap = XCreatePixmap(xdisplay, RootWindow(xdisplay, screen_num),
+                                dest_w, dest_h, DefaultDepth(xdisplay, screen_num));
+        cache->bg = cairo_xlib_surface_create(xdisplay, xpixmap,
+                                              GDK_VISUAL_XVISUAL(gdk_screen_get_system_visual(screen)),
+                                              dest_w, dest_h);
+#ifdef HAVE_XSHM
+        if(_upload_bg_image_shm(xdisplay, xpixmap,
+                                GDK_VISUAL_XVISUAL(gdk_screen_get_system_visual(screen)),
+                                DefaultDepth(xdisplay, screen_num), image))
+        {
+            /* let cairo know the pixmap was changed behind its back */
+            cairo_surface_mark_dirty(cache->bg);
+            return;
+        }
+#endif
+#endif
+    }
+    else
+    {
+        /* the composed image can be used as is */
+        cache->bg = cairo_surface_reference(image);
+        return;
+    }
+    cr = cairo_create(cache->bg);
+#else
+    cache->bg = gdk_pixmap_new(gtk_widget_get_window(widget), dest_w, dest_h, -1);
+#ifdef HAVE_XSHM
+    if(_upload_bg_image_shm(GDK_PIXMAP_XDISPLAY(cache->bg), GDK_PIXMAP_XID(cache->bg),
+                            GDK_VISUAL_XVISUAL(gtk_widget_get_visual(widget)),
+                            gdk_drawable_get_depth(cache->bg), image))
+        return;
+#endif
+    cr = gdk_cairo_create(cache->bg);
+#endif
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(cr, image, 0, 0);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+}
+
+static void _set_bg_color(FmDesktop *desktop)
+{
+    GdkWindow *window = gtk_widget_get_window(_get_bg_widget(desktop));
+#if GTK_CHECK_VERSION(3, 0, 0)
+    cairo_pattern_t *pattern;
+
+    pattern = cairo_pattern_create_rgb(desktop->conf.desktop_bg.red / 65535.0,
+                                       desktop->conf.desktop_bg.green / 65535.0,
+                                       desktop->conf.desktop_bg.blue / 65535.0);
+    gdk_window_set_background_pattern(window, pattern);
+    cairo_pattern_destroy(pattern);
+#else
+    GdkColor bg = desktop->conf.desktop_bg;
+
+    gdk_colormap_alloc_color(gdk_drawable_get_colormap(window), &bg, FALSE, TRUE);
+    gdk_window_set_back_pixmap(window, NULL, FALSE);
+    gdk_window_set_background(window, &bg);
+#endif
+    gdk_window_invalidate_rect(window, NULL, TRUE);
+}
+
+static void _set_bg_image(FmDesktop *desktop, FmBackgroundCache *cache)
+{
+    GtkWidget *widget = _get_bg_widget(desktop);
+    GdkWindow *window = gtk_widget_get_window(widget);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    cairo_pattern_t *pattern;
+#endif
+#ifdef HAVE_X11
+    GdkScreen *screen = gtk_widget_get_screen(widget);
+    GdkWindow *root = gdk_screen_get_root_window(screen);
+    int screen_num = gdk_screen_get_number(screen);
+    Display* xdisplay;
+    Pixmap xpixmap;
+    Window xroot;
+#endif
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+    pattern = cairo_pattern_create_for_surface(cache->bg);
+    if(cache->wallpaper_mode == FM_WP_SCREEN)
+    {
+        /* the image is shared by all monitors, show our part of it */
+        GdkRectangle geom;
+        cairo_matrix_t matrix;
+
+        gdk_screen_get_monitor_geometry(gtk_widget_get_screen(widget),
+                                        desktop->monitor, &geom);
+        cairo_matrix_init_translate(&matrix, geom.x, geom.y);
+        cairo_pattern_set_matrix(pattern, &matrix);
+    }
+    gdk_window_set_background_pattern(window, pattern);
+    cairo_pattern_destroy(pattern);
+#else
+    gdk_window_set_back_pixmap(window, cache->bg, FALSE);
+#endif
+
+#ifdef HAVE_X11
+    if(IS_X11())
+    {
+        /* set root map here */
+        xdisplay = GDK_WINDOW_XDISPLAY(root);
+        xroot = RootWindow(xdisplay, screen_num);
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+        xpixmap = cairo_xlib_surface_get_drawable(cache->bg);
+#else
+        xpixmap = GDK_WINDOW_XWINDOW(cache->bg);
+#endif
+
+        /* the image is uploaded already so grab only for properties swap */
+        XGrabServer (xdisplay);
+
+        XChangeProperty(xdisplay, GDK_WINDOW_XID(root),
+                        XA_XROOTMAP_ID, XA_PIXMAP, 32, PropModeReplace, (guchar*)&xpixmap, 1);
+
+#if 0
+        result = XGetWindowProperty (display,
+                                     RootWindow (display, screen_num),
+                                     gdk_x11_get_xatom_by_name ("ESETROOT_PMAP_ID"),
+                                     0L, 1L, False, XA_PIXMAP,
+                                     &type, &format, &nitems,
+                                     &bytes_after,
+                                     &data_esetroot);
+
+        if (data_esetroot != NULL) {
+                if (result == Success && type == XA_PIXMAP &&
+                    format == 32 &&
+                    nitems == 1) {
+                        gdk_error_trap_push ();
+                        XKillClient (display, *(Pixmap *)data_esetroot);
+                        gdk_error_trap_pop_ignored ();
                 }
-                wallpaper = desktop->conf.wallpaper;
+                XFree (data_esetroot);
+        }
+
+        XChangeProperty (display, RootWindow (display, screen_num),
+                         gdk_x11_get_xatom_by_name ("ESETROOT_PMAP_ID"),
+                         XA_PIXMAP, 32, PropModeReplace,
+                         (guchar *) &xpixmap, 1);
+#endif
+
+        XChangeProperty(xdisplay, xroot, XA_XROOTPMAP_ID, XA_PIXMAP, 32,
+                        PropModeReplace, (guchar*)&xpixmap, 1);
+
+        XUngrabServer(xdisplay);
+
+        XSetWindowBackgroundPixmap(xdisplay, xroot, xpixmap);
+        XClearWindow(xdisplay, xroot);
+
+        XFlush(xdisplay);
+    }
+#endif
+
+    gdk_window_invalidate_rect(window, NULL, TRUE);
+}
+
+/* images with the same key are shared by all desktops */
+static FmBackgroundCache *_find_bg_cache(FmBackgroundJob *job)
+{
+    FmBackgroundCache *cache;
+
+    for(cache = bg_cache; cache; cache = cache->next)
+        if(cache->screen == job->screen && cache->mtime == job->mtime
+           && cache->wallpaper_mode == job->wallpaper_mode
+           && cache->dest_w == job->dest_w && cache->dest_h == job->dest_h
+           && cache->x == job->x && cache->y == job->y
+           && gdk_color_equal(&cache->desktop_bg, &job->desktop_bg)
+           && strcmp(cache->filename, job->filename) == 0)
+            return cache;
+    return NULL;
+}
+
+static FmBackgroundCache *_add_bg_cache(FmDesktop *desktop, FmBackgroundJob *job)
+{
+    FmBackgroundCache *cache = g_slice_new0(FmBackgroundCache);
+
+    cache->filename = g_strdup(job->filename);
+    cache->file = _ref_wallpaper_file(job->file);
+    /* the loader could stat the file before it was queried */
+    cache->mtime = job->file_mtime;
+    cache->wallpaper_mode = job->wallpaper_mode;
+    cache->screen = job->screen;
+    cache->desktop_bg = job->desktop_bg;
+    cache->dest_w = job->dest_w;
+    cache->dest_h = job->dest_h;
+    cache->x = job->x;
+    cache->y = job->y;
+    _upload_bg_image(desktop, cache, job->image);
+    cache->size = (gsize)cairo_image_surface_get_width(job->image)
+                  * cairo_image_surface_get_height(job->image) * 4;
+    cache->next = bg_cache;
+    bg_cache = cache;
+    bg_cache_size += cache->size;
+    g_debug("adding new FmBackgroundCache for %s", cache->filename);
+    _dump_bg_cache();
+    return cache;
+}
+
+static void _unshow_bg_cache(FmDesktop *desktop)
+{
+    if(desktop->bg_shown)
+    {
+        desktop->bg_shown->shown--;
+        desktop->bg_shown = NULL;
+    }
+}
+
+/* sets image as background for the desktop and makes it most recently used */
+static void _show_bg_cache(FmDesktop *desktop, FmBackgroundCache *cache)
+{
+    FmBackgroundCache **prev;
+
+    for(prev = &bg_cache; *prev != cache; prev = &(*prev)->next);
+    *prev = cache->next;
+    cache->next = bg_cache;
+    bg_cache = cache;
+    cache->shown++;
+    _set_bg_image(desktop, cache);
+    /* the previous image was shown until now so may be dropped only now */
+    _unshow_bg_cache(desktop);
+    desktop->bg_shown = cache;
+    _trim_bg_cache();
+}
+
+/* wallpaper files in use are watched so switching desktops doesn't need to
+   stat() them, bug #3613571 - replacing the file should affect the desktop;
+   files are referenced by desktops, jobs and cached images, and are freed
+   with their monitors when nobody uses them anymore */
+struct _FmWallpaperFile
+{
+    char *filename; /* key in wallpaper_files */
+    int n_ref;
+    FmWallpaperFile *dir; /* referenced directory of slideshow or NULL */
+    GFileMonitor *mon;
+    GCancellable *query; /* the first query is in progress */
+    time_t mtime;
+    goffset size;
+    gboolean known : 1; /* the first query is done */
+    gboolean is_dir : 1; /* directory with images for slideshow */
+    gboolean watched : 1; /* either by mon or by monitor of the directory */
+    gboolean list_again : 1; /* directory was changed while listing it */
+    GPtrArray *slides; /* sorted paths of images if is_dir, NULL if unknown */
+    GCancellable *listing; /* slides are being listed without blocking */
+    GPtrArray *new_slides; /* images found by the listing so far */
+};
+
+static GHashTable *wallpaper_files = NULL;
+
+static void update_background(FmDesktop* desktop, int is_it);
+
+static void on_wallpaper_file_changed(GFileMonitor *mon, GFile *gf, GFile *other,
+                                      GFileMonitorEvent evt, gpointer user_data);
+static void on_wallpaper_info_ready(GObject *obj, GAsyncResult *res, gpointer user_data);
+static void _list_slides(FmWallpaperFile *wf);
+
+static void _free_slide_list(GPtrArray *slides)
+{
+    if(slides)
+    {
+        g_ptr_array_foreach(slides, (GFunc)g_free, NULL);
+        g_ptr_array_free(slides, TRUE);
+    }
+}
+
+static FmWallpaperFile *_ref_wallpaper_file(FmWallpaperFile *wf)
+{
+    wf->n_ref++;
+    return wf;
+}
+
+static void _unref_wallpaper_file(FmWallpaperFile *wf)
+{
+    if(wf == NULL || --wf->n_ref > 0)
+        return;
+    g_hash_table_remove(wallpaper_files, wf->filename);
+    if(g_hash_table_size(wallpaper_files) == 0)
+    {
+        g_hash_table_destroy(wallpaper_files);
+        wallpaper_files = NULL;
+    }
+    if(wf->query)
+    {
+        g_cancellable_cancel(wf->query);
+        g_object_unref(wf->query);
+    }
+    if(wf->listing)
+    {
+        g_cancellable_cancel(wf->listing);
+        g_object_unref(wf->listing);
+    }
+    if(wf->mon)
+    {
+        g_signal_handlers_disconnect_by_func(wf->mon, on_wallpaper_file_changed, wf);
+        g_file_monitor_cancel(wf->mon);
+        g_object_unref(wf->mon);
+    }
+    _free_slide_list(wf->slides);
+    _free_slide_list(wf->new_slides);
+    _unref_wallpaper_file(wf->dir);
+    g_free(wf->filename);
+    g_slice_free(FmWallpaperFile, wf);
+}
+
+/* continues what was waiting for wf to be known, see _wallpaper_file_is_ready() */
+static void _wallpaper_file_ready(FmWallpaperFile *wf)
+{
+    int i;
+
+    _ref_wallpaper_file(wf);
+    for(i = 0; i < n_screens; i++)
+    {
+        if(!desktops[i])
+            continue;
+        if(desktops[i]->wallpaper_file == wf)
+            update_background(desktops[i], -1);
+        if(desktops[i]->prefetch_wait == wf)
+        {
+            desktops[i]->prefetch_wait = NULL;
+            _unref_wallpaper_file(wf);
+            _queue_prefetch(desktops[i]);
+        }
+    }
+    _unref_wallpaper_file(wf);
+}
+
+/* returns TRUE if wf is known and, if it's a directory, its images are
+   listed; otherwise starts that and _wallpaper_file_ready() will be called */
+static gboolean _wallpaper_file_is_ready(FmWallpaperFile *wf)
+{
+    if(!wf->known)
+        return FALSE;
+    if(!wf->is_dir || wf->slides != NULL)
+        return TRUE;
+    _list_slides(wf);
+    return FALSE;
+}
+
+static void on_wallpaper_file_queried(GObject *obj, GAsyncResult *res, gpointer user_data)
+{
+    FmWallpaperFile *wf = user_data;
+    GFile *gf = G_FILE(obj);
+    GFileInfo *inf;
+    GError *err = NULL;
+
+    inf = g_file_query_info_finish(gf, res, &err);
+    if(inf == NULL)
+    {
+        gboolean cancelled = g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+        g_error_free(err);
+        if(cancelled) /* wf is freed already */
+            return;
+    }
+    g_object_unref(wf->query);
+    wf->query = NULL;
+    wf->known = TRUE;
+    if(inf)
+    {
+        wf->mtime = (time_t)g_file_info_get_attribute_uint64(inf, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+        wf->size = g_file_info_get_size(inf);
+        wf->is_dir = (g_file_info_get_file_type(inf) == G_FILE_TYPE_DIRECTORY);
+        g_object_unref(inf);
+    }
+    /* images of slideshow are watched by monitor of the directory */
+    if(wf->dir && wf->dir->watched)
+        wf->watched = TRUE;
+    else
+    {
+        if(wf->is_dir)
+            wf->mon = g_file_monitor_directory(gf, G_FILE_MONITOR_NONE, NULL, NULL);
+        else
+            wf->mon = g_file_monitor_file(gf, G_FILE_MONITOR_NONE, NULL, NULL);
+        if(wf->mon)
+        {
+            g_signal_connect(wf->mon, "changed", G_CALLBACK(on_wallpaper_file_changed), wf);
+            wf->watched = TRUE;
+        }
+    }
+    /* images of the directory should be listed before it can be shown */
+    if(wf->is_dir)
+        _list_slides(wf);
+    else
+        _wallpaper_file_ready(wf);
+}
+
+static void _query_wallpaper_file(const char *filename, GCancellable *cancellable,
+                                  GAsyncReadyCallback callback, gpointer user_data)
+{
+    GFile *gf = g_file_new_for_path(filename);
+
+    g_file_query_info_async(gf, G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                                G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                            G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT,
+                            cancellable, callback, user_data);
+    g_object_unref(gf);
+}
+
+/* returns new reference to the file, it is queried without blocking when
+   seen first time so its data are valid only after it's known, images of
+   slideshow are watched by monitor of directory dir */
+static FmWallpaperFile *_new_wallpaper_file(const char *filename, FmWallpaperFile *dir)
+{
+    FmWallpaperFile *wf;
+
+    if(G_UNLIKELY(wallpaper_files == NULL))
+        wallpaper_files = g_hash_table_new(g_str_hash, g_str_equal);
+    wf = g_hash_table_lookup(wallpaper_files, filename);
+    if(wf)
+    {
+        /* no monitoring available (remote FS?), do it the old way */
+        if(wf->known && !wf->watched)
+            _query_wallpaper_file(filename, NULL, on_wallpaper_info_ready, NULL);
+        return _ref_wallpaper_file(wf);
+    }
+    wf = g_slice_new0(FmWallpaperFile);
+    wf->filename = g_strdup(filename);
+    wf->n_ref = 1;
+    if(dir)
+        wf->dir = _ref_wallpaper_file(dir);
+    wf->query = g_cancellable_new();
+    g_hash_table_insert(wallpaper_files, wf->filename, wf);
+    _query_wallpaper_file(filename, wf->query, on_wallpaper_file_queried, wf);
+    return wf;
+}
+
+/* drops images of filename which aren't shown now from the cache */
+static void _drop_bg_cache(const char *filename)
+{
+    FmBackgroundCache **prev, *cache;
+    gboolean changed = FALSE;
+
+    for(prev = &bg_cache; (cache = *prev) != NULL; )
+    {
+        if(cache->shown == 0 && strcmp(cache->filename, filename) == 0)
+        {
+            *prev = cache->next;
+            bg_cache_size -= cache->size;
+            _free_bg_cache(cache);
+            changed = TRUE;
+        }
+        else
+            prev = &cache->next;
+    }
+    if(changed)
+        _dump_bg_cache();
+}
+
+static void _wallpaper_file_updated(const char *filename)
+{
+    int i;
+
+    /* drop outdated images, shown ones will be replaced */
+    _drop_bg_cache(filename);
+    for(i = 0; i < n_screens; i++)
+        if(desktops[i] && desktops[i]->bg_shown
+           && strcmp(desktops[i]->bg_shown->filename, filename) == 0)
+            update_background(desktops[i], -1);
+}
+
+static void on_wallpaper_info_ready(GObject *obj, GAsyncResult *res, gpointer user_data)
+{
+    GFile *gf = G_FILE(obj);
+    GFileInfo *inf = g_file_query_info_finish(gf, res, NULL);
+    char *filename = g_file_get_path(gf);
+    FmWallpaperFile *wf = NULL;
+    time_t mtime = 0;
+    goffset size = 0;
+
+    if(inf)
+    {
+        mtime = (time_t)g_file_info_get_attribute_uint64(inf, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+        size = g_file_info_get_size(inf);
+        g_object_unref(inf);
+    }
+    if(filename && wallpaper_files)
+        wf = g_hash_table_lookup(wallpaper_files, filename);
+    if(wf && (wf->mtime != mtime || wf->size != size))
+    {
+        wf->mtime = mtime;
+        wf->size = size;
+        _wallpaper_file_updated(filename);
+    }
+    g_free(filename);
+}
+
+static void on_wallpaper_file_changed(GFileMonitor *mon, GFile *gf, GFile *other,
+                                      GFileMonitorEvent evt, gpointer user_data)
+{
+    FmWallpaperFile *wf = user_data;
+
+    switch(evt)
+    {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_DELETED:
+        /* list of images is updated without blocking, the old one is
+           used until then */
+        if(wf->is_dir && wf->slides)
+            _list_slides(wf);
+        /* fall through */
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+        /* it is not urgent, query it without blocking */
+        g_file_query_info_async(gf, G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                    G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                                G_FILE_QUERY_INFO_NONE, G_PRIORITY_LOW, NULL,
+                                on_wallpaper_info_ready, NULL);
+        break;
+    default: ;
+    }
+}
+
+static gboolean _is_image_name(const char *name)
+{
+    static GHashTable *exts = NULL;
+    const char *ext = strrchr(name, '.');
+    char *lower;
+    gboolean res;
+
+    if(G_UNLIKELY(exts == NULL))
+    {
+        GSList *formats = gdk_pixbuf_get_formats(), *l;
+        char **list, **e;
+
+        exts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        for(l = formats; l; l = l->next)
+        {
+            list = gdk_pixbuf_format_get_extensions(l->data);
+            for(e = list; *e; e++)
+                g_hash_table_insert(exts, g_ascii_strdown(*e, -1), GINT_TO_POINTER(1));
+            g_strfreev(list);
+        }
+        g_slist_free(formats);
+    }
+    if(ext == NULL)
+        return FALSE;
+    lower = g_ascii_strdown(ext + 1, -1);
+    res = (g_hash_table_lookup(exts, lower) != NULL);
+    g_free(lower);
+    return res;
+}
+
+static gint _cmp_slides(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+#define SLIDES_LIST_BATCH 64
+
+static void _slides_listed(FmWallpaperFile *wf, GFileEnumerator *enu)
+{
+    gboolean first = (wf->slides == NULL);
+
+    if(enu)
+    {
+        g_file_enumerator_close_async(enu, G_PRIORITY_LOW, NULL, NULL, NULL);
+        g_object_unref(enu);
+    }
+    g_object_unref(wf->listing);
+    wf->listing = NULL;
+    g_ptr_array_sort(wf->new_slides, _cmp_slides);
+    _free_slide_list(wf->slides);
+    wf->slides = wf->new_slides;
+    wf->new_slides = NULL;
+    if(wf->list_again)
+    {
+        wf->list_again = FALSE;
+        _list_slides(wf);
+    }
+    /* a refreshed list is used since the next slide */
+    if(first)
+        _wallpaper_file_ready(wf);
+}
+
+static void on_slides_next_files(GObject *obj, GAsyncResult *res, gpointer user_data)
+{
+    GFileEnumerator *enu = G_FILE_ENUMERATOR(obj);
+    FmWallpaperFile *wf = user_data;
+    GList *infos, *l;
+    GError *err = NULL;
+    const char *name;
+
+    infos = g_file_enumerator_next_files_finish(enu, res, &err);
+    if(err)
+    {
+        gboolean cancelled = g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+        g_error_free(err);
+        if(cancelled) /* wf is freed already */
+        {
+            g_object_unref(enu);
+            return;
+        }
+    }
+    if(infos == NULL) /* end of directory or error */
+    {
+        _slides_listed(wf, enu);
+        return;
+    }
+    for(l = infos; l; l = l->next)
+    {
+        name = g_file_info_get_name(l->data);
+        if(name[0] != '.' && _is_image_name(name))
+            g_ptr_array_add(wf->new_slides, g_build_filename(wf->filename, name, NULL));
+        g_object_unref(l->data);
+    }
+    g_list_free(infos);
+    g_file_enumerator_next_files_async(enu, SLIDES_LIST_BATCH, G_PRIORITY_LOW,
+                                       wf->listing, on_slides_next_files, wf);
+}
+
+static void on_slides_enumerated(GObject *obj, GAsyncResult *res, gpointer user_data)
+{
+    FmWallpaperFile *wf = user_data;
+    GFileEnumerator *enu;
+    GError *err = NULL;
+
+    enu = g_file_enumerate_children_finish(G_FILE(obj), res, &err);
+    if(enu == NULL)
+    {
+        gboolean cancelled = g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+        g_error_free(err);
+        if(cancelled) /* wf is freed already */
+            return;
+        _slides_listed(wf, NULL); /* no images */
+        return;
+    }
+    g_file_enumerator_next_files_async(enu, SLIDES_LIST_BATCH, G_PRIORITY_LOW,
+                                       wf->listing, on_slides_next_files, wf);
+}
+
+/* lists images of the directory without blocking, then replaces slides */
+static void _list_slides(FmWallpaperFile *wf)
+{
+    GFile *gf;
+
+    if(wf->listing)
+    {
+        wf->list_again = TRUE;
+        return;
+    }
+    wf->listing = g_cancellable_new();
+    wf->new_slides = g_ptr_array_new();
+    gf = g_file_new_for_path(wf->filename);
+    g_file_enumerate_children_async(gf, G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                    G_FILE_QUERY_INFO_NONE, G_PRIORITY_LOW,
+                                    wf->listing, on_slides_enumerated, wf);
+    g_object_unref(gf);
+}
+
+/* returns new reference to image to show for wallpaper wf, if it's
+   a directory then n-th image in it, or NULL if there are no images
+   or they aren't listed yet, see _wallpaper_file_is_ready() */
+static FmWallpaperFile *_get_slide(FmWallpaperFile *wf, guint n)
+{
+    if(!wf->is_dir)
+        return _ref_wallpaper_file(wf);
+    if(wf->slides == NULL || wf->slides->len == 0)
+        return NULL;
+    return _new_wallpaper_file(g_ptr_array_index(wf->slides, n % wf->slides->len), wf);
+}
+
+static gboolean on_slideshow_timeout(gpointer user_data)
+{
+    FmDesktop *desktop = user_data;
+    char *prev = NULL;
+    FmWallpaperFile *wf = desktop->wallpaper_file;
+
+    /* changes aren't monitored so list it again, the new list is used
+       since the next slide */
+    if(wf && wf->is_dir && !wf->watched && wf->slides)
+        _list_slides(wf);
+    if(desktop->bg_shown)
+        prev = g_strdup(desktop->bg_shown->filename);
+    /* the next image is usually prefetched already, see on_idle_prefetch() */
+    desktop->slide++;
+    update_background(desktop, -1);
+    /* it will not be needed soon, and it's still in the disk cache anyway */
+    if(prev)
+        _drop_bg_cache(prev);
+    g_free(prev);
+    return TRUE;
+}
+
+static void _slideshow_stop(FmDesktop *desktop)
+{
+    if(desktop->slide_timer)
+    {
+        g_source_remove(desktop->slide_timer);
+        desktop->slide_timer = 0;
+    }
+    g_free(desktop->slideshow);
+    desktop->slideshow = NULL;
+}
+
+/* starts slideshow of images in dir or updates its settings */
+static void _slideshow_start(FmDesktop *desktop, const char *dir)
+{
+    if(g_strcmp0(desktop->slideshow, dir) != 0)
+    {
+        g_free(desktop->slideshow);
+        desktop->slideshow = g_strdup(dir);
+    }
+    if(desktop->slide_timer)
+    {
+        if(desktop->slide_interval == desktop->conf.slideshow_interval)
+            return;
+        g_source_remove(desktop->slide_timer);
+        desktop->slide_timer = 0;
+    }
+    desktop->slide_interval = desktop->conf.slideshow_interval;
+    if(desktop->slide_interval > 0)
+        desktop->slide_timer = gdk_threads_add_timeout_seconds(desktop->slide_interval,
+                                                               on_slideshow_timeout,
+                                                               desktop);
+}
+
+/* creates a job for the image wf with the current settings of desktop */
+static FmBackgroundJob *_bg_job_new(FmDesktop *desktop, FmWallpaperFile *wf)
+{
+    GdkScreen *screen = gtk_widget_get_screen(_get_bg_widget(desktop));
+    FmBackgroundJob *job;
+    GdkRectangle geom;
+
+    job = g_slice_new0(FmBackgroundJob);
+    job->filename = g_strdup(wf->filename);
+    job->file = _ref_wallpaper_file(wf);
+    job->mtime = wf->mtime;
+    job->fsize = wf->size;
+    job->disk_cache_limit = (gsize)MAX(app_config->wallpaper_disk_cache_size, 0) << 20;
+    job->screen = screen;
+    job->wallpaper_mode = desktop->conf.wallpaper_mode;
+    job->desktop_bg = desktop->conf.desktop_bg;
+    if(job->wallpaper_mode != FM_WP_TILE)
+    {
+        gdk_screen_get_monitor_geometry(screen, desktop->monitor, &geom);
+        if (job->wallpaper_mode == FM_WP_SCREEN)
+        {
+            job->dest_w = gdk_screen_get_width(screen);
+            job->dest_h = gdk_screen_get_height(screen);
+#if !GTK_CHECK_VERSION(3, 0, 0)
+            /* GTK+ 2 cannot offset background pixmap so it is composed for
+               each monitor, with GTK+ 3 it is shared, see _set_bg_image() */
+            job->x = -geom.x;
+            job->y = -geom.y;
+#endif
+        }
+        else
+        {
+            job->dest_w = geom.width;
+            job->dest_h = geom.height;
+        }
+    }
+    return job;
+}
+
+static gboolean _bg_job_equal(FmBackgroundJob *a, FmBackgroundJob *b)
+{
+    return (a->screen == b->screen && strcmp(a->filename, b->filename) == 0
+            && a->mtime == b->mtime && a->wallpaper_mode == b->wallpaper_mode
+            && a->dest_w == b->dest_w && a->dest_h == b->dest_h
+            && a->x == b->x && a->y == b->y
+            && gdk_color_equal(&a->desktop_bg, &b->desktop_bg));
+}
+
+static void _bg_job_start(FmDesktop *desktop, FmBackgroundJob *job)
+{
+    job->desktop = g_object_ref(desktop);
+    job->cancellable = g_cancellable_new();
+    if(G_UNLIKELY(bg_pool == NULL))
+        bg_pool = g_thread_pool_new(_bg_job_run, NULL, 2, FALSE, NULL);
+    g_thread_pool_push(bg_pool, job, NULL);
+}
+
+/* number of workspaces which were shown recently kept for prefetching */
+#define BG_PREFETCH_RECENT G_N_ELEMENTS(((FmDesktop*)NULL)->recent_desktops)
+
+static void _remember_desktop(FmDesktop *desktop, guint n)
+{
+    guint i;
+
+    /* move it to the head of the list or drop the oldest one */
+    for(i = 0; i < desktop->n_recent; i++)
+        if(desktop->recent_desktops[i] == n)
+            break;
+    if(i == desktop->n_recent)
+    {
+        if(desktop->n_recent < BG_PREFETCH_RECENT)
+            desktop->n_recent++;
+        else
+            i--;
+    }
+    memmove(&desktop->recent_desktops[1], &desktop->recent_desktops[0],
+            i * sizeof(desktop->recent_desktops[0]));
+    desktop->recent_desktops[0] = n;
+}
+
+/* returns workspace number for i-th prefetch candidate or -1 */
+static gint _get_prefetch_desktop(FmDesktop *desktop, guint i)
+{
+    gint n = desktop->conf.wallpapers_configured;
+
+    if(n <= 1)
+        return -1;
+    switch(i)
+    {
+    case 0: /* next workspace */
+        return (desktop->cur_desktop + 1) % n;
+    case 1: /* previous workspace */
+        return (desktop->cur_desktop + n - 1) % n;
+    default: /* recently shown ones */
+        i -= 2;
+        if(i >= desktop->n_recent)
+            return -1;
+        return (gint)desktop->recent_desktops[i];
+    }
+}
+
+/* starts prefetching of job if it's not cached yet, returns TRUE if no more
+   candidates should be tried now */
+static gboolean _prefetch_start(FmDesktop *desktop, FmBackgroundJob *job, gsize limit)
+{
+    if(_find_bg_cache(job) != NULL)
+    {
+        _bg_job_free(job);
+        return FALSE;
+    }
+    /* images which are shown now should not be dropped by prefetch */
+    if(bg_cache_size + (gsize)job->dest_w * job->dest_h * 4 > limit)
+    {
+        _bg_job_free(job);
+        return TRUE;
+    }
+    g_debug("prefetching wallpaper %s", job->filename);
+    job->prefetch = TRUE;
+    desktop->prefetch_job = job;
+    _bg_job_start(desktop, job);
+    return TRUE;
+}
+
+/* TRUE if user input is queued, unlike gtk_events_pending() which is TRUE
+   for any ready source such as timers or redraws; GDK has no API to walk
+   its queue so all events are taken out and put back in the same order */
+static gboolean _input_events_pending(void)
+{
+    GSList *events = NULL, *l;
+    GdkEvent *event;
+    gboolean input = FALSE;
+
+    while((event = gdk_event_get()) != NULL)
+        events = g_slist_prepend(events, event);
+    events = g_slist_reverse(events);
+    for(l = events; l; l = l->next)
+    {
+        event = l->data;
+        switch(event->type)
+        {
+        case GDK_MOTION_NOTIFY:
+        case GDK_BUTTON_PRESS:
+        case GDK_2BUTTON_PRESS:
+        case GDK_3BUTTON_PRESS:
+        case GDK_BUTTON_RELEASE:
+        case GDK_KEY_PRESS:
+        case GDK_KEY_RELEASE:
+        case GDK_SCROLL:
+            input = TRUE;
+            break;
+        default:
+            break;
+        }
+        gdk_event_put(event);
+        gdk_event_free(event);
+    }
+    g_slist_free(events);
+    return input;
+}
+
+static gboolean on_idle_prefetch(gpointer user_data)
+{
+    FmDesktop *desktop = user_data;
+    FmWallpaperFile *wf, *image;
+    const char *wallpaper;
+    gboolean started;
+    gsize limit;
+    gint n;
+
+    /* don't compete with user input, try later */
+    if(_input_events_pending())
+        return TRUE;
+    desktop->idle_prefetch = 0;
+    if(desktop->conf.wallpaper_mode == FM_WP_COLOR)
+        return FALSE;
+    limit = _wallpaper_cache_limit();
+    /* the next image of slideshow should be ready before its time comes, it
+       is the only one prefetched so only two slides are kept in memory */
+    if(desktop->prefetch_next == 0)
+    {
+        desktop->prefetch_next++;
+        if(desktop->slide_timer
+           && (image = _get_slide(desktop->wallpaper_file, desktop->slide + 1)) != NULL)
+        {
+            started = _prefetch_start(desktop, _bg_job_new(desktop, image), limit);
+            _unref_wallpaper_file(image);
+            if(started)
+                return FALSE;
+        }
+    }
+    if(desktop->conf.wallpaper_common)
+        return FALSE;
+    while((n = _get_prefetch_desktop(desktop, desktop->prefetch_next - 1)) >= 0)
+    {
+        desktop->prefetch_next++;
+        if(n == (gint)desktop->cur_desktop || n >= desktop->conf.wallpapers_configured)
+            continue;
+        wallpaper = desktop->conf.wallpapers[n];
+        if(!wallpaper || !*wallpaper)
+            continue;
+        wf = _new_wallpaper_file(wallpaper, NULL);
+        if(!_wallpaper_file_is_ready(wf))
+        {
+            /* try it again when it's known, see _wallpaper_file_ready() */
+            desktop->prefetch_next--;
+            desktop->prefetch_wait = wf;
+            break;
+        }
+        image = _get_slide(wf, desktop->slide);
+        _unref_wallpaper_file(wf);
+        if(image)
+        {
+            started = _prefetch_start(desktop, _bg_job_new(desktop, image), limit);
+            _unref_wallpaper_file(image);
+            if(started)
+                break;
+        }
+    }
+    return FALSE;
+}
+
+static void _queue_prefetch(FmDesktop *desktop)
+{
+    if(!desktop->idle_prefetch && !desktop->prefetch_job && !desktop->bg_job
+       && !desktop->prefetch_wait)
+        desktop->idle_prefetch = gdk_threads_add_idle_full(G_PRIORITY_LOW,
+                                                           on_idle_prefetch,
+                                                           desktop, NULL);
+}
+
+/* returns TRUE if job is kept to be finished later */
+static gboolean _prefetch_finished(FmBackgroundJob *job)
+{
+    FmDesktop *desktop = job->desktop;
+    gsize limit = _wallpaper_cache_limit();
+    FmBackgroundCache *cache;
+
+    if(desktop->prefetch_job != job || g_cancellable_is_cancelled(job->cancellable))
+        return FALSE;
+    if(job->image && _input_events_pending())
+    {
+        /* keep the image but don't compete with user input, the job stays
+           in prefetch_job so _prefetch_cancel() still can drop it */
+        gdk_threads_add_idle_full(G_PRIORITY_LOW, _bg_job_finished, job, NULL);
+        return TRUE;
+    }
+    desktop->prefetch_job = NULL;
+    if(job->image && !_find_bg_cache(job) &&
+            bg_cache_size + (gsize)cairo_image_surface_get_width(job->image)
+                            * cairo_image_surface_get_height(job->image) * 4 <= limit)
+    {
+        cache = _add_bg_cache(desktop, job);
+        /* it should be dropped before anything shown recently */
+        bg_cache = cache->next;
+        cache->next = NULL;
+        if(bg_cache)
+        {
+            FmBackgroundCache *last = bg_cache;
+
+            while(last->next)
+                last = last->next;
+            last->next = cache;
+        }
+        else
+            bg_cache = cache;
+    }
+    _queue_prefetch(desktop);
+    return FALSE;
+}
+
+/* shows the result of job on other desktops which wait for the same image */
+static void _bg_job_wake_waiters(FmBackgroundJob *job, FmBackgroundCache *cache)
+{
+    FmDesktop *other;
+    int i;
+
+    for(i = 0; i < n_screens; i++)
+    {
+        other = desktops[i];
+        if(!other || !other->bg_wait || !_bg_job_equal(other->bg_wait, job))
+            continue;
+        _bg_job_free(other->bg_wait);
+        other->bg_wait = NULL;
+        if(cache)
+        {
+            _show_bg_cache(other, cache);
+            _queue_prefetch(other);
+        }
+        else
+        {
+            _set_bg_color(other);
+            _unshow_bg_cache(other);
+        }
+    }
+}
+
+static gboolean _bg_job_finished(gpointer data)
+{
+    FmBackgroundJob *job = data;
+    FmDesktop *desktop = job->desktop;
+    FmBackgroundCache *cache;
+
+    if(job->prefetch)
+    {
+        if(_prefetch_finished(job))
+            return FALSE;
+        goto _done;
+    }
+    if(desktop->bg_job != job || g_cancellable_is_cancelled(job->cancellable))
+        goto _done; /* update_background() was called again */
+    desktop->bg_job = NULL;
+    if(!job->image)
+    {
+        _set_bg_color(desktop);
+        _unshow_bg_cache(desktop);
+        _bg_job_wake_waiters(job, NULL);
+        _trim_bg_cache();
+        goto _done;
+    }
+    /* another monitor could prepare the same image meanwhile */
+    cache = _find_bg_cache(job);
+    if(!cache)
+        cache = _add_bg_cache(desktop, job);
+    _show_bg_cache(desktop, cache);
+    _bg_job_wake_waiters(job, cache);
+    _queue_prefetch(desktop);
+_done:
+    _bg_job_free(job);
+    return FALSE;
+}
+
+static void update_background(FmDesktop* desktop, int is_it)
+{
+    FmBackgroundCache *cache;
+    FmBackgroundJob *job;
+    FmWallpaperFile *wf = NULL, *image = NULL;
+    const char *wallpaper;
+    int i;
+
+    if (!desktop->conf.wallpaper_common)
+    {
+        guint32 cur_desktop = desktop->cur_desktop;
+
+        if(is_it >= 0) /* signal "changed::wallpaper" */
+        {
+            wallpaper = desktop->conf.wallpaper;
+            if((gint)cur_desktop >= desktop->conf.wallpapers_configured)
+            {
+                desktop->conf.wallpapers = g_renew(char *, desktop->conf.wallpapers, cur_desktop + 1);
+                /* fill the gap with current wallpaper */
+                for(i = MAX(desktop->conf.wallpapers_configured,0); i < (int)cur_desktop; i++)
+                    desktop->conf.wallpapers[i] = g_strdup(wallpaper);
+                desktop->conf.wallpapers[cur_desktop] = NULL;
+                desktop->conf.wallpapers_configured = cur_desktop + 1;
+            }
+            /* old image will be dropped from cache when it's not needed */
+            else if (g_strcmp0(desktop->conf.wallpapers[cur_desktop], wallpaper))
+            {
+                g_free(desktop->conf.wallpapers[cur_desktop]);
                 desktop->conf.wallpapers[cur_desktop] = g_strdup(wallpaper);
             }
         }
@@ -2239,241 +4975,76 @@ static void update_background(FmDesktop* desktop, int is_it)
         }
     }
     else
-    {
-        _clear_bg_cache(desktop);
         wallpaper = desktop->conf.wallpaper;
-    }
 
     if(desktop->conf.wallpaper_mode != FM_WP_COLOR && wallpaper && *wallpaper)
-    {
-        struct stat st; /* for mtime */
+        wf = _new_wallpaper_file(wallpaper, NULL);
+    _unref_wallpaper_file(desktop->wallpaper_file);
+    desktop->wallpaper_file = wf;
+    /* the previous background stays until the file is queried and images
+       of directory are listed, then this is called again */
+    if(wf && !_wallpaper_file_is_ready(wf))
+        return;
 
-        /* bug #3613571 - replacing the file will not affect the desktop
-           we will call stat on each desktop change but it's inevitable */
-        if (stat(wallpaper, &st) < 0)
-            st.st_mtime = 0;
-        for(cache = desktop->cache; cache; cache = cache->next)
-            if(strcmp(wallpaper, cache->filename) == 0)
-                break;
-        if(cache && cache->wallpaper_mode == desktop->conf.wallpaper_mode
-           && st.st_mtime == cache->mtime)
-            pix = NULL; /* no new pix for it */
-        else if((pix = gdk_pixbuf_new_from_file(wallpaper, NULL)))
-        {
-            if(cache)
-            {
-                /* the same file but mode was changed */
-                _free_cache_image(cache);
-            }
-            else if(desktop->cache)
-            {
-                for(cache = desktop->cache; cache->next; )
-                    cache = cache->next;
-                cache->next = g_new0(FmBackgroundCache, 1);
-                cache = cache->next;
-            }
-            else
-                desktop->cache = cache = g_new0(FmBackgroundCache, 1);
-            if(!cache->filename)
-                cache->filename = g_strdup(wallpaper);
-            cache->mtime = st.st_mtime;
-            g_debug("adding new FmBackgroundCache for %s", wallpaper);
-        }
-        else
-            /* if there is a cached image but with another mode and we cannot
-               get it from file for new mode then just leave it in cache as is */
-            cache = NULL;
+    /* a directory is shown as slideshow */
+    if(wf && wf->is_dir)
+    {
+        _slideshow_start(desktop, wallpaper);
+        image = _get_slide(wf, desktop->slide);
     }
     else
-        cache = NULL;
-
-    if(!cache) /* solid color only */
     {
-#if GTK_CHECK_VERSION(3, 0, 0)
-        pattern = cairo_pattern_create_rgb(desktop->conf.desktop_bg.red / 65535.0,
-                                           desktop->conf.desktop_bg.green / 65535.0,
-                                           desktop->conf.desktop_bg.blue / 65535.0);
-        gdk_window_set_background_pattern(window, pattern);
-        cairo_pattern_destroy(pattern);
-#else
-        GdkColor bg = desktop->conf.desktop_bg;
+        _slideshow_stop(desktop);
+        if(wf)
+            image = _ref_wallpaper_file(wf);
+    }
 
-        gdk_colormap_alloc_color(gdk_drawable_get_colormap(window), &bg, FALSE, TRUE);
-        gdk_window_set_back_pixmap(window, NULL, FALSE);
-        gdk_window_set_background(window, &bg);
-#endif
-        gdk_window_invalidate_rect(window, NULL, TRUE);
+    if(!image)
+    {
+        _bg_job_cancel(desktop);
+        _prefetch_cancel(desktop);
+        _set_bg_color(desktop);
+        _unshow_bg_cache(desktop);
+        _trim_bg_cache();
         return;
     }
 
-    if(!cache->bg) /* no cached image found */
+    /* prefetching is restarted when the wallpaper is shown */
+    _prefetch_cancel(desktop);
+    desktop->prefetch_next = 0;
+    job = _bg_job_new(desktop, image);
+    _unref_wallpaper_file(image);
+    cache = _find_bg_cache(job);
+    if(cache)
     {
-        int src_w, src_h;
-        int dest_w, dest_h;
-        int x = 0, y = 0;
-        src_w = gdk_pixbuf_get_width(pix);
-        src_h = gdk_pixbuf_get_height(pix);
-        if(desktop->conf.wallpaper_mode == FM_WP_TILE)
-        {
-            dest_w = src_w;
-            dest_h = src_h;
-        }
-        else
-        {
-            GdkRectangle geom;
-            gdk_screen_get_monitor_geometry(screen, desktop->monitor, &geom);
-            if (desktop->conf.wallpaper_mode == FM_WP_SCREEN)
-            {
-                dest_w = gdk_screen_get_width(screen);
-                dest_h = gdk_screen_get_height(screen);
-                x = -geom.x;
-                y = -geom.y;
-            }
-            else
-            {
-                dest_w = geom.width;
-                dest_h = geom.height;
-            }
-        }
-#if GTK_CHECK_VERSION(3, 0, 0)
-        if(IS_X11())
-        {
-#ifdef HAVE_X11
-            xdisplay = GDK_WINDOW_XDISPLAY(root);
-            /* this code is taken from libgnome-desktop */
-            xpixmap = XCreatePixmap(xdisplay, RootWindow(xdisplay, screen_num),
-                                    dest_w, dest_h, DefaultDepth(xdisplay, screen_num));
-            cache->bg = cairo_xlib_surface_create(xdisplay, xpixmap,
-                                                  GDK_VISUAL_XVISUAL(gdk_screen_get_system_visual(screen)),
-                                                  dest_w, dest_h);
-#endif
-        }
-        else
-            cache->bg = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, dest_w, dest_h);
-        cr = cairo_create(cache->bg);
-#else
-        cache->bg = gdk_pixmap_new(window, dest_w, dest_h, -1);
-        cr = gdk_cairo_create(cache->bg);
-#endif
-        if(gdk_pixbuf_get_has_alpha(pix)
-            || desktop->conf.wallpaper_mode == FM_WP_CENTER
-            || desktop->conf.wallpaper_mode == FM_WP_FIT)
-        {
-            gdk_cairo_set_source_color(cr, &desktop->conf.desktop_bg);
-            cairo_rectangle(cr, 0, 0, dest_w, dest_h);
-            cairo_fill(cr);
-        }
-
-        switch(desktop->conf.wallpaper_mode)
-        {
-        case FM_WP_TILE:
-            break;
-        case FM_WP_STRETCH:
-        case FM_WP_SCREEN:
-            if(dest_w == src_w && dest_h == src_h)
-                scaled = (GdkPixbuf*)g_object_ref(pix);
-            else
-                scaled = gdk_pixbuf_scale_simple(pix, dest_w, dest_h, GDK_INTERP_BILINEAR);
-            g_object_unref(pix);
-            pix = scaled;
-            break;
-        case FM_WP_FIT:
-        case FM_WP_CROP:
-            if(dest_w != src_w || dest_h != src_h)
-            {
-                gdouble w_ratio = (float)dest_w / src_w;
-                gdouble h_ratio = (float)dest_h / src_h;
-                gdouble ratio = (desktop->conf.wallpaper_mode == FM_WP_FIT)
-                    ? MIN(w_ratio, h_ratio)
-                    : MAX(w_ratio, h_ratio);
-                if(ratio != 1.0)
-                {
-                    src_w *= ratio;
-                    src_h *= ratio;
-                    scaled = gdk_pixbuf_scale_simple(pix, src_w, src_h, GDK_INTERP_BILINEAR);
-                    g_object_unref(pix);
-                    pix = scaled;
-                }
-            }
-            /* continue to execute code in case FM_WP_CENTER */
-        case FM_WP_CENTER:
-            x = (dest_w - src_w)/2;
-            y = (dest_h - src_h)/2;
-            break;
-        case FM_WP_COLOR: ; /* handled above */
-        }
-        gdk_cairo_set_source_pixbuf(cr, pix, x, y);
-        cairo_paint(cr);
-        cairo_destroy(cr);
-        cache->wallpaper_mode = desktop->conf.wallpaper_mode;
+        _bg_job_cancel(desktop);
+        _show_bg_cache(desktop, cache);
+        _bg_job_free(job);
+        _queue_prefetch(desktop);
+        return;
     }
-#if GTK_CHECK_VERSION(3, 0, 0)
-    pattern = cairo_pattern_create_for_surface(cache->bg);
-    gdk_window_set_background_pattern(window, pattern);
-    cairo_pattern_destroy(pattern);
-#else
-    gdk_window_set_back_pixmap(window, cache->bg, FALSE);
-#endif
 
-#ifdef HAVE_X11
-    if(IS_X11())
+    /* don't restart the same job if it's still in progress */
+    if((desktop->bg_job && _bg_job_equal(desktop->bg_job, job)) ||
+       (desktop->bg_wait && _bg_job_equal(desktop->bg_wait, job)))
     {
-        /* set root map here */
-        xdisplay = GDK_WINDOW_XDISPLAY(root);
-        xroot = RootWindow(xdisplay, screen_num);
-
-#if GTK_CHECK_VERSION(3, 0, 0)
-        xpixmap = cairo_xlib_surface_get_drawable(cache->bg);
-#else
-        xpixmap = GDK_WINDOW_XWINDOW(cache->bg);
-#endif
-
-        XChangeProperty(xdisplay, GDK_WINDOW_XID(root),
-                        XA_XROOTMAP_ID, XA_PIXMAP, 32, PropModeReplace, (guchar*)&xpixmap, 1);
-
-        XGrabServer (xdisplay);
-
-#if 0
-        result = XGetWindowProperty (display,
-                                     RootWindow (display, screen_num),
-                                     gdk_x11_get_xatom_by_name ("ESETROOT_PMAP_ID"),
-                                     0L, 1L, False, XA_PIXMAP,
-                                     &type, &format, &nitems,
-                                     &bytes_after,
-                                     &data_esetroot);
-
-        if (data_esetroot != NULL) {
-                if (result == Success && type == XA_PIXMAP &&
-                    format == 32 &&
-                    nitems == 1) {
-                        gdk_error_trap_push ();
-                        XKillClient (display, *(Pixmap *)data_esetroot);
-                        gdk_error_trap_pop_ignored ();
-                }
-                XFree (data_esetroot);
-        }
-
-        XChangeProperty (display, RootWindow (display, screen_num),
-                         gdk_x11_get_xatom_by_name ("ESETROOT_PMAP_ID"),
-                         XA_PIXMAP, 32, PropModeReplace,
-                         (guchar *) &xpixmap, 1);
-#endif
-
-        XChangeProperty(xdisplay, xroot, XA_XROOTPMAP_ID, XA_PIXMAP, 32,
-                        PropModeReplace, (guchar*)&xpixmap, 1);
-
-        XSetWindowBackgroundPixmap(xdisplay, xroot, xpixmap);
-        XClearWindow(xdisplay, xroot);
-
-        XFlush(xdisplay);
-        XUngrabServer(xdisplay);
+        _bg_job_free(job);
+        return;
     }
-#endif
-
-    if(pix)
-        g_object_unref(pix);
-
-    gdk_window_invalidate_rect(window, NULL, TRUE);
+    /* decoding and scaling of large image may take long time so it is done
+       in a thread, previous background is shown until the new one is ready */
+    _bg_job_cancel(desktop);
+    /* the same image may be composed already for another monitor, e.g. with
+       FM_WP_SCREEN mode, then just wait for it */
+    for(i = 0; i < n_screens; i++)
+        if(desktops[i] && desktops[i] != desktop && desktops[i]->bg_job
+           && _bg_job_equal(desktops[i]->bg_job, job))
+        {
+            desktop->bg_wait = job;
+            return;
+        }
+    desktop->bg_job = job;
+    _bg_job_start(desktop, job);
 }
 
 
@@ -2481,65 +5052,104 @@ static void update_background(FmDesktop* desktop, int is_it)
     FmFolderModel signal handlers */
 
 static void on_row_deleting(FmFolderModel* model, GtkTreePath* tp,
-                            GtkTreeIter* iter, gpointer data, FmDesktop* desktop)
+                            GtkTreeIter* iter, gpointer unused, FmDesktop* desktop)
 {
+    gint n = gtk_tree_path_get_indices(tp)[0];
+    FmDesktopItem* item = g_ptr_array_index(desktop->items, n);
     GList *l;
 
     for(l = desktop->fixed_items; l; l = l->next)
-        if(l->data == data)
+        if(l->data == item)
         {
             desktop->fixed_items = g_list_delete_link(desktop->fixed_items, l);
+            desktop->occupied_dirty = TRUE;
             break;
         }
-    if((gpointer)desktop->focus == data)
+    if(desktop->focus == item)
     {
-        GtkTreeIter it = *iter;
-        fm_desktop_accessible_focus_unset(desktop, data);
-        if(gtk_tree_model_iter_next(GTK_TREE_MODEL(model), &it))
-            desktop->focus = fm_folder_model_get_item_userdata(model, &it);
+        fm_desktop_accessible_focus_unset(desktop, item);
+        if((guint)n + 1 < desktop->items->len)
+            desktop->focus = g_ptr_array_index(desktop->items, n + 1);
+        else if(n > 0)
+            desktop->focus = g_ptr_array_index(desktop->items, n - 1);
         else
-        {
-            if(gtk_tree_path_prev(tp))
-            {
-                gtk_tree_model_get_iter(GTK_TREE_MODEL(model), &it, tp);
-                gtk_tree_path_next(tp);
-                desktop->focus = fm_folder_model_get_item_userdata(model, &it);
-            }
-            else
-                desktop->focus = NULL;
-        }
+            desktop->focus = NULL;
         if (desktop->focus)
             fm_desktop_accessible_focus_set(desktop, desktop->focus);
     }
-    if((gpointer)desktop->drop_hilight == data)
+    if(desktop->drop_hilight == item)
         desktop->drop_hilight = NULL;
-    if((gpointer)desktop->hover_item == data)
+    if(desktop->hover_item == item)
     {
         desktop->hover_item = NULL;
         /* bug #3615015: after deleting the item tooltip stuck on the desktop */
         g_object_set(G_OBJECT(desktop), "tooltip-text", NULL, NULL);
     }
-    fm_desktop_accessible_item_deleted(desktop, data);
-    desktop_item_free(data);
+    hit_grid_remove(desktop, item);
+    if (item->hidden)
+    {
+        desktop->n_hidden--;
+        redraw_more_items(desktop);
+    }
+    else if (gtk_widget_get_realized(GTK_WIDGET(desktop)))
+        redraw_item(desktop, item);
+    if (is_layout_valid(desktop))
+    {
+        /* only items after this one should be moved */
+        if (desktop->layout_unordered)
+            queue_layout_items(desktop);
+        else if (!item->fixed_pos && !item->hidden)
+            queue_relayout_items(desktop, n, item);
+        else
+        {
+            if (desktop->idle_relayout && n < desktop->relayout_from)
+                desktop->relayout_from--;
+            /* the freed place can be taken by auto items now */
+            if (item->fixed_pos && !item->hidden)
+                queue_relayout_freed(desktop, n, item);
+        }
+    }
+    fm_desktop_accessible_item_deleted(desktop, item);
+    items_remove(desktop, n);
+    desktop->search_dirty = TRUE;
+    desktop_item_free(item);
 }
 
 static void on_row_inserted(FmFolderModel* mod, GtkTreePath* tp, GtkTreeIter* it, FmDesktop* desktop)
 {
     FmDesktopItem* item = desktop_item_new(mod, it);
     gint *indices = gtk_tree_path_get_indices(tp);
-    fm_desktop_accessible_item_added(desktop, item, indices[0]);
-    fm_folder_model_set_item_userdata(mod, it, item);
-    queue_layout_items(desktop);
-}
+    GdkPixbuf* icon = NULL;
 
-static void on_row_deleted(FmFolderModel* mod, GtkTreePath* tp, FmDesktop* desktop)
-{
-    queue_layout_items(desktop);
+    fm_desktop_accessible_item_added(desktop, item, indices[0]);
+    items_insert(desktop, item, indices[0]);
+    desktop->search_dirty = TRUE;
+    if (is_layout_valid(desktop) && desktop->idle_relayout == 0)
+    {
+        /* put new item into the next free place, it will be moved into
+           its place in model order on next full layout */
+        gtk_tree_model_get(GTK_TREE_MODEL(mod), it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
+        place_item(desktop, item, icon, TRUE);
+        if (icon)
+            g_object_unref(icon);
+        if (item->hidden)
+            redraw_more_items(desktop);
+        else
+        {
+            hit_grid_add(desktop, item);
+            redraw_item(desktop, item);
+        }
+        /* the flow isn't in model order anymore unless item is the last */
+        if ((guint)indices[0] + 1 < desktop->items->len)
+            desktop->layout_unordered = TRUE;
+    }
+    else
+        queue_layout_items(desktop);
 }
 
 static void on_row_changed(FmFolderModel* model, GtkTreePath* tp, GtkTreeIter* it, FmDesktop* desktop)
 {
-    FmDesktopItem* item = fm_folder_model_get_item_userdata(model, it);
+    FmDesktopItem* item = g_ptr_array_index(desktop->items, gtk_tree_path_get_indices(tp)[0]);
     GdkPixbuf *icon;
 
     fm_file_info_unref(item->fi);
@@ -2547,10 +5157,27 @@ static void on_row_changed(FmFolderModel* model, GtkTreePath* tp, GtkTreeIter* i
                        FM_FOLDER_MODEL_COL_INFO, &item->fi,
                        FM_FOLDER_MODEL_COL_ICON, &icon, -1);
     fm_file_info_ref(item->fi);
+    /* display name may be changed */
+    if (item->layout)
+    {
+        g_object_unref(item->layout);
+        item->layout = NULL;
+    }
+    g_free(item->search_name);
+    item->search_name = NULL;
+    desktop->search_dirty = TRUE;
+    /* it will be measured when it gets a place on the screen */
+    if (item->hidden)
+    {
+        if (icon)
+            g_object_unref(icon);
+        return;
+    }
 
     /* we need to redraw old area as we changing data */
     redraw_item(desktop, item);
     calc_item_size(desktop, item, icon);
+    hit_grid_update(desktop, item);
     if (icon)
         g_object_unref(icon);
     redraw_item(desktop, item);
@@ -2560,6 +5187,8 @@ static void on_row_changed(FmFolderModel* model, GtkTreePath* tp, GtkTreeIter* i
 static void on_rows_reordered(FmFolderModel* model, GtkTreePath* parent_tp, GtkTreeIter* parent_it, gpointer new_order, FmDesktop* desktop)
 {
     fm_desktop_accessible_items_reordered(desktop, GTK_TREE_MODEL(model), new_order);
+    items_reorder(desktop, new_order);
+    desktop->search_dirty = TRUE;
     queue_layout_items(desktop);
 }
 
@@ -2670,6 +5299,8 @@ static GdkFilterReturn on_root_event(GdkXEvent *xevent, GdkEvent *event, gpointe
                                     gtk_widget_get_screen(GTK_WIDGET(data))));
             if(desktop >= 0)
             {
+                if((guint)desktop != self->cur_desktop)
+                    _remember_desktop(self, self->cur_desktop);
                 self->cur_desktop = (guint)desktop;
                 if(!self->conf.wallpaper_common)
                     update_background(self, -1);
@@ -2888,6 +5519,7 @@ static void on_fix_pos(GtkToggleAction* act, gpointer user_data)
             {
                 item->fixed_pos = TRUE;
                 desktop->fixed_items = g_list_prepend(desktop->fixed_items, item);
+                occupied_mark(desktop, item);
             }
         }
     }
@@ -2899,6 +5531,7 @@ static void on_fix_pos(GtkToggleAction* act, gpointer user_data)
             item->fixed_pos = FALSE;
             desktop->fixed_items = g_list_remove(desktop->fixed_items, item);
         }
+        desktop->occupied_dirty = TRUE;
         queue_layout_items(desktop);
     }
     g_list_free(items);
@@ -2927,7 +5560,10 @@ static void on_disable(GtkAction* act, gpointer user_data)
         return;
     }
     queue_config_save(desktop);
-    fm_folder_model_extra_file_remove(desktop->model, item->fi);
+    if (is_model_shared(desktop, n_screens))
+        reconnect_model(desktop);
+    else
+        fm_folder_model_extra_file_remove(desktop->model, item->fi);
 }
 #endif
 
@@ -2978,18 +5614,22 @@ static gboolean is_point_in_rect(GdkRectangle* rect, int x, int y)
     return x >= rect->x && x < (rect->x + rect->width) && y >= rect->y && y < (rect->y + rect->height);
 }
 
-static FmDesktopItem* hit_test(FmDesktop* self, GtkTreeIter *it, int x, int y)
+/* returns the first item in model order which is under the point */
+static FmDesktopItem* hit_test(FmDesktop* self, int x, int y)
 {
     FmDesktopItem* item;
-    GtkTreeModel* model;
+    FmDesktopItem* found = NULL;
+    GSList *l;
 
-    if (!self->model)
+    if (!self->model || self->hit_grid == NULL)
         return NULL;
-    model = GTK_TREE_MODEL(self->model);
-    if(model && gtk_tree_model_get_iter_first(model, it)) do
+    items_index_update(self);
+    l = self->hit_grid[hit_grid_index(y, self->cell_h, self->hit_grid_rows) * self->hit_grid_cols
+                       + hit_grid_index(x, self->cell_w, self->hit_grid_cols)];
+    for (; l; l = l->next)
     {
         GdkRectangle icon_rect;
-        item = fm_folder_model_get_item_userdata(self->model, it);
+        item = l->data;
         /* we cannot drop dragged items onto themselves */
         if (item->is_selected && self->dragging)
             continue;
@@ -2997,144 +5637,148 @@ static FmDesktopItem* hit_test(FmDesktop* self, GtkTreeIter *it, int x, int y)
            so let expand icon test area up to text_rect */
         icon_rect = item->icon_rect;
         icon_rect.height = item->text_rect.y - icon_rect.y;
-        if(is_point_in_rect(&icon_rect, x, y)
-         || is_point_in_rect(&item->text_rect, x, y))
-            return item;
+        if((is_point_in_rect(&icon_rect, x, y)
+            || is_point_in_rect(&item->text_rect, x, y))
+           && (found == NULL || item->index < found->index))
+            found = item;
     }
-    while(gtk_tree_model_iter_next(model, it));
-    return NULL;
+    return found;
+}
+
+/* for keyboard navigation shown items are kept sorted by position along
+   each axis, ties are broken by model order as the linear search did */
+#define NAV_MAJOR(item, vert) ((vert) ? (item)->area.y : (item)->area.x)
+#define NAV_MINOR(item, vert) ((vert) ? (item)->area.x : (item)->area.y)
+
+static gint nav_item_compare(gconstpointer a, gconstpointer b, gpointer vert)
+{
+    FmDesktopItem* item1 = *(FmDesktopItem**)a;
+    FmDesktopItem* item2 = *(FmDesktopItem**)b;
+
+    if (NAV_MAJOR(item1, vert) != NAV_MAJOR(item2, vert))
+        return (NAV_MAJOR(item1, vert) < NAV_MAJOR(item2, vert)) ? -1 : 1;
+    if (NAV_MINOR(item1, vert) != NAV_MINOR(item2, vert))
+        return (NAV_MINOR(item1, vert) < NAV_MINOR(item2, vert)) ? -1 : 1;
+    return (item1->index < item2->index) ? -1 : (item1->index > item2->index);
+}
+
+static void nav_items_update(FmDesktop* desktop)
+{
+    FmDesktopItem* item;
+    guint i, vert;
+
+    if (!desktop->nav_dirty)
+        return;
+    items_index_update(desktop); /* used by nav_item_compare() */
+    for (vert = 0; vert < 2; vert++)
+    {
+        g_ptr_array_set_size(desktop->nav_items[vert], 0);
+        for (i = 0; i < desktop->items->len; i++)
+        {
+            item = g_ptr_array_index(desktop->items, i);
+            if (!item->hidden)
+                g_ptr_array_add(desktop->nav_items[vert], item);
+        }
+        g_ptr_array_sort_with_data(desktop->nav_items[vert], nav_item_compare,
+                                   GUINT_TO_POINTER(vert));
+    }
+    desktop->nav_dirty = FALSE;
+}
+
+/* returns index of the first item positioned at (major, minor) or after */
+static guint nav_items_search(GPtrArray* nav, gboolean vert, gint major, gint minor)
+{
+    FmDesktopItem* item;
+    guint lo = 0, hi = nav->len, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        item = g_ptr_array_index(nav, mid);
+        if (NAV_MAJOR(item, vert) < major ||
+            (NAV_MAJOR(item, vert) == major && NAV_MINOR(item, vert) < minor))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
 static FmDesktopItem* get_nearest_item(FmDesktop* desktop, FmDesktopItem* item,  GtkDirectionType dir)
 {
-    GtkTreeModel* model;
-    FmDesktopItem* item2, *ret = NULL;
-    guint min_x_dist, min_y_dist, dist;
-    GtkTreeIter it;
+    FmDesktopItem *before, *after;
+    GPtrArray* nav;
+    gboolean vert, forward;
+    gint major, minor;
+    guint i, first, last;
 
-    if (!desktop->model)
-        return NULL;
-    model = GTK_TREE_MODEL(desktop->model);
-    if(!gtk_tree_model_get_iter_first(model, &it))
+    if(desktop->items->len == 0)
         return NULL;
     if(!item) /* there is no focused item yet, select first one then */
-        return fm_folder_model_get_item_userdata(desktop->model, &it);
-
-    min_x_dist = min_y_dist = (guint)-1;
-    item2 = NULL;
+        return g_ptr_array_index(desktop->items, 0);
 
     switch(dir)
     {
     case GTK_DIR_LEFT:
-        do
-        {
-            item2 = fm_folder_model_get_item_userdata(desktop->model, &it);
-            if(item2->area.x >= item->area.x)
-                continue;
-            dist = item->area.x - item2->area.x;
-            if(dist < min_x_dist)
-            {
-                ret = item2;
-                min_x_dist = dist;
-                min_y_dist = ABS(item->area.y - item2->area.y);
-            }
-            else if(dist == min_x_dist && item2 != ret) /* if there is another item of the same x distance */
-            {
-                /* get the one with smaller y distance */
-                dist = ABS(item2->area.y - item->area.y);
-                if(dist < min_y_dist)
-                {
-                    ret = item2;
-                    min_y_dist = dist;
-                }
-            }
-        }
-        while(gtk_tree_model_iter_next(model, &it));
+        vert = FALSE;
+        forward = FALSE;
         break;
     case GTK_DIR_RIGHT:
-        do
-        {
-            item2 = fm_folder_model_get_item_userdata(desktop->model, &it);
-            if(item2->area.x <= item->area.x)
-                continue;
-            dist = item2->area.x - item->area.x;
-            if(dist < min_x_dist)
-            {
-                ret = item2;
-                min_x_dist = dist;
-                min_y_dist = ABS(item->area.y - item2->area.y);
-            }
-            else if(dist == min_x_dist && item2 != ret) /* if there is another item of the same x distance */
-            {
-                /* get the one with smaller y distance */
-                dist = ABS(item2->area.y - item->area.y);
-                if(dist < min_y_dist)
-                {
-                    ret = item2;
-                    min_y_dist = dist;
-                }
-            }
-        }
-        while(gtk_tree_model_iter_next(model, &it));
+        vert = FALSE;
+        forward = TRUE;
         break;
     case GTK_DIR_UP:
-        do
-        {
-            item2 = fm_folder_model_get_item_userdata(desktop->model, &it);
-            if(item2->area.y >= item->area.y)
-                continue;
-            dist = item->area.y - item2->area.y;
-            if(dist < min_y_dist)
-            {
-                ret = item2;
-                min_y_dist = dist;
-                min_x_dist = ABS(item->area.x - item2->area.x);
-            }
-            else if(dist == min_y_dist && item2 != ret) /* if there is another item of the same y distance */
-            {
-                /* get the one with smaller x distance */
-                dist = ABS(item2->area.x - item->area.x);
-                if(dist < min_x_dist)
-                {
-                    ret = item2;
-                    min_x_dist = dist;
-                }
-            }
-        }
-        while(gtk_tree_model_iter_next(model, &it));
+        vert = TRUE;
+        forward = FALSE;
         break;
     case GTK_DIR_DOWN:
-        do
-        {
-            item2 = fm_folder_model_get_item_userdata(desktop->model, &it);
-            if(item2->area.y <= item->area.y)
-                continue;
-            dist = item2->area.y - item->area.y;
-            if(dist < min_y_dist)
-            {
-                ret = item2;
-                min_y_dist = dist;
-                min_x_dist = ABS(item->area.x - item2->area.x);
-            }
-            else if(dist == min_y_dist && item2 != ret) /* if there is another item of the same y distance */
-            {
-                /* get the one with smaller x distance */
-                dist = ABS(item2->area.x - item->area.x);
-                if(dist < min_x_dist)
-                {
-                    ret = item2;
-                    min_x_dist = dist;
-                }
-            }
-        }
-        while(gtk_tree_model_iter_next(model, &it));
-        break;
-    case GTK_DIR_TAB_FORWARD: /* FIXME */
+        vert = TRUE;
+        forward = TRUE;
         break;
-    case GTK_DIR_TAB_BACKWARD: /* FIXME */
-        ;
+    default: /* FIXME: GTK_DIR_TAB_FORWARD, GTK_DIR_TAB_BACKWARD */
+        return NULL;
+    }
+
+    nav_items_update(desktop);
+    nav = desktop->nav_items[vert];
+    /* find the nearest row or column in the direction */
+    major = NAV_MAJOR(item, vert);
+    if(forward)
+    {
+        i = nav_items_search(nav, vert, major + 1, G_MININT);
+        if(i == nav->len)
+            return NULL;
+        major = NAV_MAJOR((FmDesktopItem*)g_ptr_array_index(nav, i), vert);
+    }
+    else
+    {
+        i = nav_items_search(nav, vert, major, G_MININT);
+        if(i == 0)
+            return NULL;
+        major = NAV_MAJOR((FmDesktopItem*)g_ptr_array_index(nav, i - 1), vert);
+    }
+    first = nav_items_search(nav, vert, major, G_MININT);
+    last = nav_items_search(nav, vert, major + 1, G_MININT);
+
+    /* then the item in it nearest by another coordinate, for the same
+       distance either side the one which is first in model order */
+    minor = NAV_MINOR(item, vert);
+    i = nav_items_search(nav, vert, major, minor);
+    after = (i < last) ? g_ptr_array_index(nav, i) : NULL;
+    before = NULL;
+    if(i > first)
+    {
+        before = g_ptr_array_index(nav, i - 1);
+        before = g_ptr_array_index(nav, nav_items_search(nav, vert, major,
+                                                         NAV_MINOR(before, vert)));
     }
-    return ret;
+    if(!before)
+        return after;
+    if(!after)
+        return before;
+    if(minor - NAV_MINOR(before, vert) != NAV_MINOR(after, vert) - minor)
+        return (minor - NAV_MINOR(before, vert) < NAV_MINOR(after, vert) - minor) ? before : after;
+    return (before->index < after->index) ? before : after;
 }
 
 static void set_focused_item(FmDesktop* desktop, FmDesktopItem* item)
@@ -3248,9 +5892,8 @@ static gboolean on_expose(GtkWidget* w, GdkEventExpose* evt)
 #if !GTK_CHECK_VERSION(3, 0, 0)
     cairo_t* cr;
 #endif
-    GtkTreeModel* model = self->model ? GTK_TREE_MODEL(self->model) : NULL;
-    GtkTreeIter it;
     GdkRectangle area;
+    guint i;
 
 #if GTK_CHECK_VERSION(3, 0, 0)
     if(G_UNLIKELY(!gtk_cairo_should_draw_window(cr, gtk_widget_get_window(w))))
@@ -3269,11 +5912,10 @@ static gboolean on_expose(GtkWidget* w, GdkEventExpose* evt)
     if(self->rubber_bending)
         paint_rubber_banding_rect(self, cr, &area);
 
-    if(model && gtk_tree_model_get_iter_first(model, &it)) do
+    for(i = 0; i < self->items->len; i++)
     {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(self->model, &it);
+        FmDesktopItem* item = g_ptr_array_index(self->items, i);
         GdkRectangle* intersect, tmp, tmp2;
-        GdkPixbuf* icon = NULL;
         if(gdk_rectangle_intersect(&area, &item->icon_rect, &tmp))
             intersect = &tmp;
         else
@@ -3288,14 +5930,10 @@ static gboolean on_expose(GtkWidget* w, GdkEventExpose* evt)
         }
 
         if(intersect)
-        {
-            gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
-            paint_item(self, item, cr, intersect, icon);
-            if(icon)
-                g_object_unref(icon);
-        }
+            paint_item(self, item, cr, intersect);
     }
-    while(gtk_tree_model_iter_next(model, &it));
+    if(self->n_hidden > 0 && gdk_rectangle_intersect(&area, &self->more_rect, NULL))
+        paint_more_items(self, cr);
 #if GTK_CHECK_VERSION(3, 0, 0)
     cairo_restore(cr);
 #else
@@ -3339,6 +5977,8 @@ static void on_size_allocate(GtkWidget* w, GtkAllocation* alloc)
     self->text_w += 4; /* 4 is for drawing border */
     self->cell_h = fm_config->big_icon_size + self->spacing + self->text_h + self->ypad * 2;
     self->cell_w = MAX((gint)self->text_w, fm_config->big_icon_size) + self->xpad * 2;
+    /* font or text size might be changed, labels should be shaped again */
+    self->text_serial++;
 
     update_working_area(self);
     /* queue_layout_items(self); this is called in update_working_area */
@@ -3354,8 +5994,7 @@ static void on_size_allocate(GtkWidget* w, GtkAllocation* alloc)
         pango_font_description_free(font_desc);
 #endif
         /* bug #3614866: after monitor geometry was changed we need to redraw
-           the background invalidating all the cache */
-        _clear_bg_cache(self);
+           the background, cached images are keyed by geometry */
         if(self->conf.wallpaper_mode != FM_WP_COLOR && self->conf.wallpaper_mode != FM_WP_TILE)
             update_background(self, -1);
     }
@@ -3404,6 +6043,7 @@ static void _stop_rubberbanding(FmDesktop *self, gint x, gint y)
                                           0, 0, NULL, NULL, drag_data);
     }
     self->rubber_bending = FALSE;
+    cancel_update_rubberbanding(self);
     update_rubberbanding(self, x, y);
     gtk_grab_remove(GTK_WIDGET(self));
 }
@@ -3412,10 +6052,10 @@ static gboolean on_button_press(GtkWidget* w, GdkEventButton* evt)
 {
     FmDesktop* self = (FmDesktop*)w;
     FmDesktopItem *item = NULL, *clicked_item = NULL;
-    GtkTreeIter it;
     FmFolderViewClickType clicked = FM_FV_CLICK_NONE;
 
-    clicked_item = hit_test(FM_DESKTOP(w), &it, (int)evt->x, (int)evt->y);
+    active_desktop = self;
+    clicked_item = hit_test(FM_DESKTOP(w), (int)evt->x, (int)evt->y);
 
     /* reset auto-selection now */
     if (self->single_click_timeout_handler != 0)
@@ -3492,6 +6132,12 @@ static gboolean on_button_press(GtkWidget* w, GdkEventButton* evt)
                 if(!self->conf.show_wm_menu)
                     clicked = FM_FV_CONTEXT_MENU;
             }
+            else if(evt->button == 1 && self->n_hidden > 0
+                    && is_point_in_rect(&self->more_rect, evt->x, evt->y))
+            {
+                /* show all the items which didn't fit into the screen */
+                fm_main_win_open_in_last_active(fm_folder_model_get_folder_path(self->model));
+            }
             else if(evt->button == 1)
             {
                 /* disable Gtk+ DnD callbacks, because else rubberbanding will be interrupted */
@@ -3525,8 +6171,8 @@ static gboolean on_button_press(GtkWidget* w, GdkEventButton* evt)
     {
         GtkTreePath* tp = NULL;
 
-        if(self->model && clicked_item)
-            tp = gtk_tree_model_get_path(GTK_TREE_MODEL(self->model), &it);
+        if(clicked_item)
+            tp = fm_desktop_item_get_tree_path(self, clicked_item);
         fm_folder_view_item_clicked(FM_FOLDER_VIEW(self), tp, clicked);
         if(tp)
             gtk_tree_path_free(tp);
@@ -3567,8 +6213,7 @@ static gboolean on_button_release(GtkWidget* w, GdkEventButton* evt)
     }
     else if(fm_config->single_click && evt->button == 1)
     {
-        GtkTreeIter it;
-        FmDesktopItem* clicked_item = hit_test(self, &it, evt->x, evt->y);
+        FmDesktopItem* clicked_item = hit_test(self, evt->x, evt->y);
         if(clicked_item)
             /* left single click */
             fm_launch_file_simple(GTK_WINDOW(w), NULL, clicked_item->fi, pcmanfm_open_folder, w);
@@ -3596,7 +6241,6 @@ static gboolean on_single_click_timeout(gpointer user_data)
     int x, y;
     FmDesktopItem *item;
     GdkModifierType state;
-    GtkTreeIter it;
 
     if(g_source_is_destroyed(g_main_current_source()))
         return FALSE;
@@ -3608,7 +6252,7 @@ static gboolean on_single_click_timeout(gpointer user_data)
     /* ensure we are still on the same item */
     window = gtk_widget_get_window(w);
     gdk_window_get_pointer(window, &x, &y, &state);
-    item = hit_test(self, &it, x, y);
+    item = hit_test(self, x, y);
     if (item != self->hover_item)
         return FALSE;
     /* ok, let select the item then */
@@ -3637,8 +6281,7 @@ static gboolean on_motion_notify(GtkWidget* w, GdkEventMotion* evt)
     {
         if(fm_config->single_click)
         {
-            GtkTreeIter it;
-            FmDesktopItem* item = hit_test(self, &it, evt->x, evt->y);
+            FmDesktopItem* item = hit_test(self, evt->x, evt->y);
             FmDesktopItem *hover_item = self->hover_item;
             GdkWindow* window;
 
@@ -3675,8 +6318,7 @@ static gboolean on_motion_notify(GtkWidget* w, GdkEventMotion* evt)
         }
         else
         {
-            GtkTreeIter it;
-            FmDesktopItem* item = hit_test(self, &it, evt->x, evt->y);
+            FmDesktopItem* item = hit_test(self, evt->x, evt->y);
             FmDesktopItem *hover_item = self->hover_item;
 
             if(item != hover_item)
@@ -3697,7 +6339,7 @@ static gboolean on_motion_notify(GtkWidget* w, GdkEventMotion* evt)
     }
     else if(self->rubber_bending)
     {
-        update_rubberbanding(self, evt->x, evt->y);
+        queue_update_rubberbanding(self, evt->x, evt->y);
     }
     /* we use auto-DnD so no DnD check is possible here */
 
@@ -3715,17 +6357,16 @@ static gboolean on_leave_notify(GtkWidget* w, GdkEventCrossing *evt)
     return TRUE;
 }
 
-static gboolean get_focused_item(FmDesktopItem* focus, GtkTreeModel* model, GtkTreeIter* it)
-{
-    FmDesktopItem* item;
-    if(gtk_tree_model_get_iter_first(model, it)) do
-    {
-        item = fm_folder_model_get_item_userdata(FM_FOLDER_MODEL(model), it);
-        if(item == focus)
-            return item->is_selected;
-    }
-    while(gtk_tree_model_iter_next(model, it));
-    return FALSE;
+static gboolean get_focused_item(FmDesktop* desktop, GtkTreeModel* model, GtkTreeIter* it)
+{
+    FmDesktopItem* focus = desktop->focus;
+
+    if(focus == NULL)
+        return FALSE;
+    items_index_update(desktop);
+    if(!gtk_tree_model_iter_nth_child(model, it, NULL, focus->index))
+        return FALSE;
+    return focus->is_selected;
 }
 
 /* ---- Interactive search funcs: mostly picked from ExoIconView ---- */
@@ -3799,15 +6440,118 @@ static void desktop_search_timeout_destroy(gpointer user_data)
     FM_DESKTOP(user_data)->search_timeout_id = 0;
 }
 
+/* normalized names are kept sorted so items matching the typed prefix
+   make a contiguous range which is found by binary search */
+static const char *get_item_search_name(FmDesktopItem *item)
+{
+    char *casefold;
+
+    if (item->search_name == NULL)
+    {
+        casefold = g_utf8_casefold(fm_file_info_get_disp_name(item->fi), -1);
+        item->search_name = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
+        g_free(casefold);
+        if (item->search_name == NULL) /* invalid UTF-8 */
+            item->search_name = g_strdup("");
+    }
+    return item->search_name;
+}
+
+static gint search_item_compare(gconstpointer a, gconstpointer b)
+{
+    FmDesktopItem *item1 = *(FmDesktopItem **)a;
+    FmDesktopItem *item2 = *(FmDesktopItem **)b;
+    int cmp = strcmp(item1->search_name, item2->search_name);
+
+    if (cmp != 0)
+        return cmp;
+    return (item1->index < item2->index) ? -1 : (item1->index > item2->index);
+}
+
+static void search_items_update(FmDesktop *desktop)
+{
+    FmDesktopItem *item;
+    guint i;
+
+    if (!desktop->search_dirty)
+        return;
+    items_index_update(desktop); /* used by search_item_compare() */
+    g_ptr_array_set_size(desktop->search_items, 0);
+    for (i = 0; i < desktop->items->len; i++)
+    {
+        item = g_ptr_array_index(desktop->items, i);
+        get_item_search_name(item);
+        g_ptr_array_add(desktop->search_items, item);
+    }
+    g_ptr_array_sort(desktop->search_items, search_item_compare);
+    desktop->search_dirty = FALSE;
+}
+
+/* returns index of the first item in search_items for which strncmp()
+   with the key returns more than @after (-1 or 0) */
+static guint search_items_bound(FmDesktop *desktop, const char *key, gsize len, int after)
+{
+    FmDesktopItem *item;
+    guint lo = 0, hi = desktop->search_items->len, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        item = g_ptr_array_index(desktop->search_items, mid);
+        if (strncmp(item->search_name, key, len) > after)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/* finds item which name starts with @text and which is nearest in model
+   order after the item @from (or before it if @move_up is TRUE), if @from
+   is NULL then the first matching item in model order is returned */
+static FmDesktopItem *desktop_search_find(FmDesktop *desktop, const char *text,
+                                          FmDesktopItem *from, gboolean move_up)
+{
+    char *casefold, *key;
+    FmDesktopItem *item, *found = NULL;
+    gsize len;
+    guint i, last;
+
+    /* normalize the pattern */
+    casefold = g_utf8_casefold(text, -1);
+    key = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
+    g_free(casefold);
+    if (key == NULL)
+        return NULL;
+    search_items_update(desktop);
+    items_index_update(desktop);
+    len = strlen(key);
+    last = search_items_bound(desktop, key, len, 0);
+    for (i = search_items_bound(desktop, key, len, -1); i < last; i++)
+    {
+        item = g_ptr_array_index(desktop->search_items, i);
+        if (from == NULL || !move_up)
+        {
+            if (from != NULL && item->index <= from->index)
+                continue;
+            if (found == NULL || item->index < found->index)
+                found = item;
+        }
+        else if (item->index < from->index &&
+                 (found == NULL || item->index > found->index))
+            found = item;
+    }
+    g_free(key);
+    return found;
+}
+
 static void desktop_search_move(GtkWidget *widget, FmDesktop *desktop,
                                 gboolean move_up)
 {
     GtkTreeModel *model;
     const gchar *text;
-    char *casefold, *key, *name;
     FmDesktopItem *item;
     GtkTreeIter it;
-    gboolean found = FALSE;
 
     /* check if we have a model */
     if (desktop->model == NULL)
@@ -3820,49 +6564,12 @@ static void desktop_search_move(GtkWidget *widget, FmDesktop *desktop,
         return;
 
     /* determine the iterator of the focused item */
-    if (!get_focused_item(desktop->focus, model, &it))
+    if (!get_focused_item(desktop, model, &it))
         return;
 
-    /* normalize the pattern */
-    casefold = g_utf8_casefold(text, -1);
-    key = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-    g_free(casefold);
     /* let find matched item now */
-    if (move_up)
-    {
-#if GTK_CHECK_VERSION(3, 0, 0)
-        while (!found && gtk_tree_model_iter_previous(model, &it))
-#else
-        GtkTreePath *tp = gtk_tree_model_get_path(model, &it);
-        while (!found && gtk_tree_path_prev(tp) && gtk_tree_model_get_iter(model, &it, tp))
-#endif
-        {
-            item = fm_folder_model_get_item_userdata(desktop->model, &it);
-            casefold = g_utf8_casefold(fm_file_info_get_disp_name(item->fi), -1);
-            name = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-            g_free(casefold);
-            found = (strncmp(name, key, strlen(key)) == 0);
-            g_free(name);
-        }
-#if !GTK_CHECK_VERSION(3, 0, 0)
-        gtk_tree_path_free(tp);
-#endif
-    }
-    else
-    {
-        while (!found && gtk_tree_model_iter_next(model, &it))
-        {
-            item = fm_folder_model_get_item_userdata(desktop->model, &it);
-            casefold = g_utf8_casefold(fm_file_info_get_disp_name(item->fi), -1);
-            name = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-            g_free(casefold);
-            found = (strncmp(name, key, strlen(key)) == 0);
-            g_free(name);
-        }
-    }
-    g_free(key);
-
-    if (!found)
+    item = desktop_search_find(desktop, text, desktop->focus, move_up);
+    if (item == NULL)
         return;
 
     /* unselect all items */
@@ -3954,7 +6661,7 @@ static void desktop_search_activate(GtkEntry *entry, FmDesktop *desktop)
         if (desktop->focus->is_selected)
         {
             model = GTK_TREE_MODEL(desktop->model);
-            if(get_focused_item(desktop->focus, model, &it))
+            if(get_focused_item(desktop, model, &it))
             {
                 tp = gtk_tree_model_get_path(model, &it);
                 fm_folder_view_item_clicked(FM_FOLDER_VIEW(desktop), tp, FM_FV_ACTIVATED);
@@ -4013,17 +6720,12 @@ static void desktop_search_position(FmDesktop *desktop)
 
 static void desktop_search_init(GtkWidget *search_entry, FmDesktop *desktop)
 {
-    GtkTreeModel *model;
     const gchar *text;
-    char *casefold, *key, *name;
     FmDesktopItem *item;
-    GtkTreeIter it;
-    gboolean found = FALSE;
 
     /* check if we have a model */
     if (desktop->model == NULL)
         return;
-    model = GTK_TREE_MODEL(desktop->model);
 
     /* renew the flush timeout */
     desktop_search_update_timeout(desktop);
@@ -4036,25 +6738,11 @@ static void desktop_search_init(GtkWidget *search_entry, FmDesktop *desktop)
     /* unselect all items */
     _unselect_all(FM_FOLDER_VIEW(desktop));
 
-    /* normalize the pattern */
-    casefold = g_utf8_casefold(text, -1);
-    key = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-    g_free(casefold);
     /* find first matched item now */
-    if (gtk_tree_model_get_iter_first(model, &it)) do
-    {
-        item = fm_folder_model_get_item_userdata(desktop->model, &it);
-        casefold = g_utf8_casefold(fm_file_info_get_disp_name(item->fi), -1);
-        name = g_utf8_normalize(casefold, -1, G_NORMALIZE_ALL);
-        g_free(casefold);
-        found = (strncmp(name, key, strlen(key)) == 0);
-        g_free(name);
-    }
-    while (!found && gtk_tree_model_iter_next(model, &it));
-    g_free(key);
+    item = desktop_search_find(desktop, text, NULL, FALSE);
 
     /* focus found item */
-    if (!found)
+    if (item == NULL)
         return;
     _focus_and_select_focused_item(desktop, item);
 }
@@ -4176,6 +6864,7 @@ static gboolean on_key_press(GtkWidget* w, GdkEventKey* evt)
     guint popup_menu_id;
     gboolean retval;
 
+    active_desktop = desktop;
     switch (evt->keyval)
     {
     case GDK_KEY_Escape:
@@ -4265,7 +6954,7 @@ static gboolean on_key_press(GtkWidget* w, GdkEventKey* evt)
         if(modifier == 0 && desktop->focus)
         {
             model = GTK_TREE_MODEL(desktop->model);
-            if(get_focused_item(desktop->focus, model, &it))
+            if(get_focused_item(desktop, model, &it))
             {
                 tp = gtk_tree_model_get_path(model, &it);
                 fm_folder_view_item_clicked(FM_FOLDER_VIEW(desktop), tp, FM_FV_ACTIVATED);
@@ -4344,21 +7033,36 @@ static gboolean on_key_press(GtkWidget* w, GdkEventKey* evt)
     return FALSE;
 }
 
-#if 0
+#if GTK_CHECK_VERSION(3, 0, 0)
+static void on_style_updated(GtkWidget* w)
+#else
 static void on_style_set(GtkWidget* w, GtkStyle* prev)
+#endif
 {
     FmDesktop* self = (FmDesktop*)w;
-    PangoContext* pc = gtk_widget_get_pango_context(w);
-    if(font_desc)
-        pango_context_set_font_description(pc, font_desc);
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+    if (GTK_WIDGET_CLASS(fm_desktop_parent_class)->style_updated)
+        GTK_WIDGET_CLASS(fm_desktop_parent_class)->style_updated(w);
+#else
+    if (GTK_WIDGET_CLASS(fm_desktop_parent_class)->style_set)
+        GTK_WIDGET_CLASS(fm_desktop_parent_class)->style_set(w, prev);
+#endif
+    /* it is called from fm_desktop_init() before layout is created */
+    if (self->pl == NULL)
+        return;
+    /* font may be changed so labels should be shaped again, and their
+       sizes too, so items should be placed again */
     pango_layout_context_changed(self->pl);
+    self->text_serial++;
+    queue_layout_items(self);
 }
-#endif
 
 static void on_direction_changed(GtkWidget* w, GtkTextDirection prev)
 {
     FmDesktop* self = (FmDesktop*)w;
     pango_layout_context_changed(self->pl);
+    self->text_serial++;
     queue_layout_items(self);
 }
 
@@ -4395,6 +7099,7 @@ static void on_realize(GtkWidget* w)
     pc = gtk_widget_get_pango_context(w);
     pango_context_set_font_description(pc, font_desc);
     pango_font_description_free(font_desc);
+    self->text_serial++;
 #if GTK_CHECK_VERSION(3, 0, 0)
     css_data = g_strdup_printf("FmDesktop {\n"
                                    "background-color: #%02x%02x%02x\n"
@@ -4412,14 +7117,12 @@ static void on_realize(GtkWidget* w)
 static gboolean on_focus_in(GtkWidget* w, GdkEventFocus* evt)
 {
     FmDesktop* self = (FmDesktop*) w;
-    GtkTreeIter it;
 #if !GTK_CHECK_VERSION(2, 22, 0)
     GTK_WIDGET_SET_FLAGS(w, GTK_HAS_FOCUS);
 #endif
-    if(!self->focus && self->model
-       && gtk_tree_model_get_iter_first(GTK_TREE_MODEL(self->model), &it))
+    if(!self->focus && self->items->len > 0)
     {
-        self->focus = fm_folder_model_get_item_userdata(self->model, &it);
+        self->focus = g_ptr_array_index(self->items, 0);
         fm_desktop_accessible_focus_set(self, self->focus);
     }
     if(self->focus)
@@ -4449,7 +7152,6 @@ static gboolean on_drag_motion (GtkWidget *dest_widget,
     GdkDragAction action = 0;
     FmDesktop* desktop = FM_DESKTOP(dest_widget);
     FmDesktopItem* item;
-    GtkTreeIter it;
 
     /* we don't support drag & drop if no model is set */
     if (desktop->model == NULL)
@@ -4460,7 +7162,7 @@ static gboolean on_drag_motion (GtkWidget *dest_widget,
     }
 
     /* check if we're dragging over an item */
-    item = hit_test(desktop, &it, x, y);
+    item = hit_test(desktop, x, y);
 
     /* handle moving desktop items */
     if(!item)
@@ -4520,10 +7222,9 @@ static gboolean on_drag_drop (GtkWidget *dest_widget,
 {
     FmDesktop* desktop = FM_DESKTOP(dest_widget);
     FmDesktopItem* item;
-    GtkTreeIter it;
 
     /* check if we're dropping on an item */
-    item = hit_test(desktop, &it, x, y);
+    item = hit_test(desktop, x, y);
 
     /* handle moving desktop items */
     if(!item)
@@ -4570,88 +7271,177 @@ static void on_drag_data_received (GtkWidget *dest_widget,
     gtk_drag_finish(drag_context, TRUE, FALSE, time);
 }
 
+/* the drag icon is a stack of few selected icons and the count of items */
+#define DRAG_ICON_MAX_ITEMS 5
+#define DRAG_ICON_STEP 6 /* offset of each next icon in the stack */
+#define DRAG_ICON_MAX_SIZE 192
+
+/* returns new drag icon for the selection and its hot spot in *x, *y */
 static GdkPixbuf *_create_drag_icon(FmDesktop *desktop, gint *x, gint *y)
 {
-    GtkTreeModel *model;
-    FmDesktopItem *item;
+    FmDesktopItem *item, *top;
+    FmDesktopItem *stack[DRAG_ICON_MAX_ITEMS];
     cairo_surface_t *s;
     GdkPixbuf *pixbuf;
     cairo_t *cr;
     GdkPixbuf *icon;
-    GtkTreeIter it;
-    GdkRectangle area, icon_rect;
+#if GTK_CHECK_VERSION(3, 0, 0)
+    cairo_surface_t *rendered;
+#else
+    GdkPixmap *rendered;
+#endif
+    PangoLayout *layout = NULL;
+    GdkRectangle area, rect;
+    guint i, n, n_selected;
+    int size, stack_y, text_w = 0, badge_w = 0, badge_h = 0;
+    int w, h, icon_x, icon_y;
+    double scale, ox, oy, top_ox = 0.0, top_oy = 0.0, top_scale = 1.0;
+    int top_x = 0, top_y = 0, top_w = 0, top_h = 0;
 #if !GTK_CHECK_VERSION(3, 0, 0)
     guchar *dest_data, *src_data;
     int dest_stride, src_stride, _x, _y;
 #endif
 
-    if (!desktop->model)
+    /* the item under the pointer goes on top of the stack, the rest are
+       the first selected ones, only few are drawn however many are dragged */
+    top = hit_test(desktop, desktop->drag_start_x, desktop->drag_start_y);
+    if (top && (!top->is_selected || top->hidden))
+        top = NULL;
+    n = 0;
+    if (top)
+        stack[n++] = top;
+    size = 0;
+    n_selected = 0;
+    for (i = 0; i < desktop->items->len; i++)
+    {
+        item = g_ptr_array_index(desktop->items, i);
+        if (!item->is_selected)
+            continue;
+        /* hidden items are dragged too but have no place to draw from */
+        n_selected++;
+        if (n < DRAG_ICON_MAX_ITEMS && item != top && !item->hidden)
+            stack[n++] = item;
+    }
+    if (n == 0) /* no selection??? */
         return NULL;
-    model = GTK_TREE_MODEL(desktop->model);
-    if (!gtk_tree_model_get_iter_first(model, &it))
+    for (i = 0; i < n; i++)
+        size = MAX(size, MAX(stack[i]->icon_rect.width, stack[i]->icon_rect.height));
+    size = MIN(size, DRAG_ICON_MAX_SIZE - (int)(n - 1) * DRAG_ICON_STEP);
+    if (size <= 0)
         return NULL;
 
-    /* determine the size of complete pixbuf */
-    area.width = 0; /* mark it */
-    do
+    /* the count is shown in the top right corner */
+    if (n_selected > 1)
     {
-        item = fm_folder_model_get_item_userdata(desktop->model, &it);
-        if (!item->is_selected)
-            continue;
-        if (area.width == 0)
-            area = item->icon_rect;
-        else
-        {
-            if (item->icon_rect.x < area.x)
-            {
-                area.width += (area.x - item->icon_rect.x);
-                area.x = item->icon_rect.x;
-            }
-            if (item->icon_rect.x + item->icon_rect.width > area.x + area.width)
-                area.width = item->icon_rect.x + item->icon_rect.width - area.x;
-            if (item->icon_rect.y < area.y)
-            {
-                area.height += (area.y - item->icon_rect.y);
-                area.y = item->icon_rect.y;
-            }
-            if (item->icon_rect.y + item->icon_rect.height > area.y + area.height)
-                area.height = item->icon_rect.y + item->icon_rect.height - area.y;
-        }
-    }
-    while(gtk_tree_model_iter_next(model, &it));
+        char *text = g_strdup_printf("%u", n_selected);
 
-    /* now create the pixbuf */
-    if (area.width == 0) /* no selection??? */
-        return NULL;
-    area.width += 2;
-    area.height += 2;
+        layout = pango_layout_copy(desktop->pl);
+        pango_layout_set_width(layout, -1);
+        pango_layout_set_height(layout, -1);
+        pango_layout_set_text(layout, text, -1);
+        pango_layout_get_pixel_size(layout, &text_w, &badge_h);
+        badge_h += 2;
+        badge_w = MAX(text_w + badge_h, badge_h * 3 / 2);
+        g_free(text);
+    }
+    stack_y = badge_h / 2;
+    area.width = size + (n - 1) * DRAG_ICON_STEP + badge_w / 2 + 2;
+    area.height = size + (n - 1) * DRAG_ICON_STEP + stack_y + 2;
     s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, area.width, area.height);
     cr = cairo_create(s);
 
-    gtk_tree_model_get_iter_first(model, &it);
-    do
+    /* draw from the bottom of the stack, icons are cut from the rendered
+       items (see get_item_surface()), these are selected so already cached */
+    for (i = n; i-- > 0; )
     {
-        item = fm_folder_model_get_item_userdata(desktop->model, &it);
-        if (!item->is_selected)
-            continue;
-        /* FIXME: should we render name too, or is it too heavy? */
+        item = stack[i];
+        rendered = get_item_surface(desktop, item, TRUE);
         icon = NULL;
-        gtk_tree_model_get(model, &it, FM_FOLDER_MODEL_COL_ICON, &icon, -1);
-        /* draw the icon */
+        if (rendered)
+        {
+            get_item_rect(item, &rect);
+            w = item->icon_rect.width;
+            h = item->icon_rect.height;
+            icon_x = item->icon_rect.x;
+            icon_y = item->icon_rect.y;
+        }
+        else if ((icon = get_item_icon(desktop, item)) != NULL)
+        {
+            /* no ARGB visual with GTK+ 2, the cell renderer centers icon */
+            w = gdk_pixbuf_get_width(icon);
+            h = gdk_pixbuf_get_height(icon);
+            icon_x = item->icon_rect.x + (item->icon_rect.width - w) / 2;
+            icon_y = item->icon_rect.y + (item->icon_rect.height - h) / 2;
+        }
+        else
+            continue;
+        if (w <= 0 || h <= 0)
+        {
+            if (icon)
+                g_object_unref(icon);
+            continue;
+        }
+        scale = MIN(1.0, (double)size / MAX(w, h));
+        ox = 1 + i * DRAG_ICON_STEP + (size - w * scale) / 2;
+        oy = 1 + stack_y + i * DRAG_ICON_STEP + (size - h * scale) / 2;
+        cairo_save(cr);
+        cairo_translate(cr, ox, oy);
+        cairo_scale(cr, scale, scale);
         if (icon)
         {
-            icon_rect.x = item->icon_rect.x - area.x + 1;
-            icon_rect.width = item->icon_rect.width;
-            icon_rect.y = item->icon_rect.y - area.y + 1;
-            icon_rect.height = item->icon_rect.height;
-//g_debug("icon at %d %d %d %d",icon_rect.x,icon_rect.y,icon_rect.width,icon_rect.height);
-            gdk_cairo_set_source_pixbuf(cr, icon, icon_rect.x, icon_rect.y);
-            gdk_cairo_rectangle(cr, &icon_rect);
-            cairo_fill(cr);
+            gdk_cairo_set_source_pixbuf(cr, icon, 0, 0);
             g_object_unref(icon);
         }
+        else
+#if GTK_CHECK_VERSION(3, 0, 0)
+            cairo_set_source_surface(cr, rendered, rect.x - icon_x, rect.y - icon_y);
+#else
+            gdk_cairo_set_source_pixmap(cr, rendered, rect.x - icon_x, rect.y - icon_y);
+#endif
+        cairo_rectangle(cr, 0, 0, w, h);
+        cairo_fill(cr);
+        cairo_restore(cr);
+        if (item == top)
+        {
+            /* remember the transform to place the hot spot */
+            top_ox = ox;
+            top_oy = oy;
+            top_scale = scale;
+            top_x = icon_x;
+            top_y = icon_y;
+            top_w = w;
+            top_h = h;
+        }
+    }
+
+    if (layout)
+    {
+        double r = badge_h / 2.0;
+        double bx = area.width - badge_w;
+
+        cairo_new_sub_path(cr);
+        cairo_arc(cr, bx + r, r, r, G_PI / 2, 3 * G_PI / 2);
+        cairo_arc(cr, area.width - r, r, r, 3 * G_PI / 2, G_PI / 2);
+        cairo_close_path(cr);
+        gdk_cairo_set_source_color(cr, &desktop->conf.desktop_fg);
+        cairo_fill(cr);
+        gdk_cairo_set_source_color(cr, &desktop->conf.desktop_bg);
+        cairo_move_to(cr, bx + (badge_w - text_w) / 2, 1);
+        pango_cairo_show_layout(cr, layout);
+        g_object_unref(layout);
+    }
+
+    /* keep the pointer where it was grabbed on the top icon */
+    if (top && top_w > 0)
+    {
+        *x = top_ox + CLAMP(desktop->drag_start_x - top_x, 0, top_w) * top_scale;
+        *y = top_oy + CLAMP(desktop->drag_start_y - top_y, 0, top_h) * top_scale;
+    }
+    else
+    {
+        *x = size / 2 + 1;
+        *y = size / 2 + 1 + stack_y;
     }
-    while(gtk_tree_model_iter_next(model, &it));
 
     cairo_destroy (cr);
 #if GTK_CHECK_VERSION(3, 0, 0)
@@ -4695,8 +7485,6 @@ static GdkPixbuf *_create_drag_icon(FmDesktop *desktop, gint *x, gint *y)
     }
 #endif
     cairo_surface_destroy(s);
-    *x = area.x;
-    *y = area.y;
     return pixbuf;
 }
 
@@ -4704,16 +7492,14 @@ static void on_drag_begin (GtkWidget *widget, GdkDragContext *drag_context)
 {
     /* GTK auto-dragging started a drag, update state */
     FmDesktop *desktop = FM_DESKTOP(widget);
-    gint x, y, icon_x, icon_y;
-    GdkPixbuf *pix = _create_drag_icon(desktop, &x, &y);
+    gint icon_x, icon_y;
+    GdkPixbuf *pix = _create_drag_icon(desktop, &icon_x, &icon_y);
 
     desktop->dragging = TRUE;
 
     /* set drag cursor to selected items */
     if (pix)
     {
-        icon_x = desktop->drag_start_x - x;
-        icon_y = desktop->drag_start_y - y;
         gtk_drag_set_icon_pixbuf(drag_context, pix, icon_x, icon_y);
         g_object_unref(pix);
     }
@@ -4828,34 +7614,123 @@ static void on_sort_changed(GtkTreeSortable *model, FmDesktop *desktop)
     if (type == desktop->conf.desktop_sort_type &&
         by == desktop->conf.desktop_sort_by) /* not changed */
         return;
+    /* the model is shared and was sorted from the menu of another desktop,
+       this one keeps its order and goes to another model */
+    if (desktop != active_desktop && is_model_shared(desktop, n_screens))
+    {
+        reconnect_model(desktop);
+        return;
+    }
     desktop->conf.desktop_sort_type = type;
     desktop->conf.desktop_sort_by = by;
     queue_config_save(desktop);
 }
 #endif
 
+/* desktops which show the same folder with the same sorting and extra
+   items use one model, so files and icons are loaded only once for them
+   and only items geometry is kept for each desktop */
+static FmFolderModel* find_shared_model(FmDesktop *desktop, FmFolder *folder)
+{
+    FmDesktop *other;
+#if FM_CHECK_VERSION(1, 0, 2)
+    FmFolderModelCol by;
+    FmSortMode type;
+#endif
+    int i;
+
+    for (i = 0; i < n_screens; i++)
+    {
+        other = desktops[i];
+        if (other == NULL || other == desktop || other->model == NULL ||
+            fm_folder_model_get_folder(other->model) != folder)
+            continue;
+#if FM_CHECK_VERSION(1, 0, 2)
+        /* the model may be sorted already but on_sort_changed() wasn't
+           called for the other desktop yet */
+        if (!fm_folder_model_get_sort(other->model, &by, &type) ||
+            by != desktop->conf.desktop_sort_by ||
+            type != desktop->conf.desktop_sort_type)
+            continue;
+#else
+        if (other->conf.desktop_sort_by != desktop->conf.desktop_sort_by ||
+            other->conf.desktop_sort_type != desktop->conf.desktop_sort_type)
+            continue;
+#endif
+#if FM_CHECK_VERSION(1, 2, 0)
+        if (!other->conf.show_documents != !desktop->conf.show_documents ||
+            !other->conf.show_trash != !desktop->conf.show_trash ||
+            !other->conf.show_mounts != !desktop->conf.show_mounts)
+            continue;
+#endif
+        return other->model;
+    }
+    return NULL;
+}
+
+#if FM_CHECK_VERSION(1, 2, 0)
+static void add_extra_items(FmDesktop *desktop)
+{
+    GSList *msl;
+
+    if (desktop->conf.show_documents && documents && documents->fi)
+        fm_folder_model_extra_file_add(desktop->model, documents->fi,
+                                       FM_FOLDER_MODEL_ITEMPOS_PRE);
+    if (desktop->conf.show_trash && trash_can && trash_can->fi)
+        fm_folder_model_extra_file_add(desktop->model, trash_can->fi,
+                                       FM_FOLDER_MODEL_ITEMPOS_PRE);
+    if (desktop->conf.show_mounts)
+        for (msl = mounts; msl; msl = msl->next)
+            fm_folder_model_extra_file_add(desktop->model,
+                                           ((FmDesktopExtraItem *)msl->data)->fi,
+                                           FM_FOLDER_MODEL_ITEMPOS_POST);
+}
+#endif
+
 static inline void connect_model(FmDesktop *desktop, FmFolder *folder)
 {
-    desktop->model = fm_folder_model_new(folder, FALSE);
+    FmFolderModel *model = find_shared_model(desktop, folder);
+    FmDesktopItem *item;
+    GtkTreeIter it;
+
+    if (model)
+        desktop->model = g_object_ref(model);
+    else
+    {
+        desktop->model = fm_folder_model_new(folder, FALSE);
+        fm_folder_model_set_icon_size(desktop->model, fm_config->big_icon_size);
+        g_signal_connect(app_config, "changed::big_icon_size",
+                         G_CALLBACK(on_big_icon_size_changed), desktop->model);
+#if FM_CHECK_VERSION(1, 0, 2)
+        fm_folder_model_set_sort(desktop->model, desktop->conf.desktop_sort_by,
+                                 desktop->conf.desktop_sort_type);
+#else
+        gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(desktop->model),
+                                             desktop->conf.desktop_sort_by,
+                                             desktop->conf.desktop_sort_type);
+#endif
+#if FM_CHECK_VERSION(1, 2, 0)
+        add_extra_items(desktop);
+#endif
+    }
     g_signal_connect(folder, "start-loading", G_CALLBACK(on_folder_start_loading), desktop);
     g_signal_connect(folder, "finish-loading", G_CALLBACK(on_folder_finish_loading), desktop);
     g_signal_connect(folder, "error", G_CALLBACK(on_folder_error), desktop);
-    fm_folder_model_set_icon_size(desktop->model, fm_config->big_icon_size);
-    g_signal_connect(app_config, "changed::big_icon_size",
-                     G_CALLBACK(on_big_icon_size_changed), desktop->model);
+    /* the model may be filled already */
+    if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(desktop->model), &it)) do
+    {
+        item = desktop_item_new(desktop->model, &it);
+        fm_desktop_accessible_item_added(desktop, item, desktop->items->len);
+        items_insert(desktop, item, desktop->items->len);
+    }
+    while (gtk_tree_model_iter_next(GTK_TREE_MODEL(desktop->model), &it));
+    desktop->search_dirty = TRUE;
     g_signal_connect(desktop->model, "row-deleting", G_CALLBACK(on_row_deleting), desktop);
     g_signal_connect(desktop->model, "row-inserted", G_CALLBACK(on_row_inserted), desktop);
-    g_signal_connect(desktop->model, "row-deleted", G_CALLBACK(on_row_deleted), desktop);
     g_signal_connect(desktop->model, "row-changed", G_CALLBACK(on_row_changed), desktop);
     g_signal_connect(desktop->model, "rows-reordered", G_CALLBACK(on_rows_reordered), desktop);
 #if FM_CHECK_VERSION(1, 0, 2)
-    fm_folder_model_set_sort(desktop->model, desktop->conf.desktop_sort_by,
-                             desktop->conf.desktop_sort_type);
     g_signal_connect(desktop->model, "sort-column-changed", G_CALLBACK(on_sort_changed), desktop);
-#else
-    gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(desktop->model),
-                                         desktop->conf.desktop_sort_by,
-                                         desktop->conf.desktop_sort_type);
 #endif
     on_folder_start_loading(folder, desktop);
     if(fm_folder_is_loaded(folder))
@@ -4865,6 +7740,7 @@ static inline void connect_model(FmDesktop *desktop, FmFolder *folder)
 static inline void disconnect_model(FmDesktop* desktop)
 {
     FmFolder *folder;
+    guint i;
 
     if (desktop->model == NULL)
         return;
@@ -4872,10 +7748,10 @@ static inline void disconnect_model(FmDesktop* desktop)
     g_signal_handlers_disconnect_by_func(folder, on_folder_start_loading, desktop);
     g_signal_handlers_disconnect_by_func(folder, on_folder_finish_loading, desktop);
     g_signal_handlers_disconnect_by_func(folder, on_folder_error, desktop);
-    g_signal_handlers_disconnect_by_func(app_config, on_big_icon_size_changed, desktop->model);
+    if (!is_model_shared(desktop, n_screens))
+        g_signal_handlers_disconnect_by_func(app_config, on_big_icon_size_changed, desktop->model);
     g_signal_handlers_disconnect_by_func(desktop->model, on_row_deleting, desktop);
     g_signal_handlers_disconnect_by_func(desktop->model, on_row_inserted, desktop);
-    g_signal_handlers_disconnect_by_func(desktop->model, on_row_deleted, desktop);
     g_signal_handlers_disconnect_by_func(desktop->model, on_row_changed, desktop);
     g_signal_handlers_disconnect_by_func(desktop->model, on_rows_reordered, desktop);
 #if FM_CHECK_VERSION(1, 0, 2)
@@ -4883,12 +7759,36 @@ static inline void disconnect_model(FmDesktop* desktop)
 #endif
     g_object_unref(desktop->model);
     desktop->model = NULL;
+    /* items belong to this desktop, the model may be still in use */
+    unload_items(desktop);
     fm_desktop_accessible_model_removed(desktop);
+    for (i = 0; i < desktop->items->len; i++)
+        desktop_item_free(g_ptr_array_index(desktop->items, i));
+    g_ptr_array_set_size(desktop->items, 0);
+    desktop->search_dirty = TRUE;
+    desktop->layout_valid = FALSE;
+    if (desktop->idle_relayout)
+    {
+        g_source_remove(desktop->idle_relayout);
+        desktop->idle_relayout = 0;
+    }
+    hit_grid_free(desktop);
     /* update popup now */
     fm_folder_view_add_popup(FM_FOLDER_VIEW(desktop), GTK_WINDOW(desktop),
                              fm_desktop_update_popup);
 }
 
+/* the desktop gets own model (or another matching one) after its config
+   was changed so the change doesn't affect other desktops */
+static void reconnect_model(FmDesktop *desktop)
+{
+    FmFolder *folder = g_object_ref(fm_folder_model_get_folder(desktop->model));
+
+    disconnect_model(desktop);
+    connect_model(desktop, folder);
+    g_object_unref(folder);
+}
+
 #if FM_CHECK_VERSION(1, 2, 0)
 static void on_show_full_names_changed(FmConfig *cfg, FmDesktop *self)
 {
@@ -4902,6 +7802,7 @@ static void on_show_full_names_changed(FmConfig *cfg, FmDesktop *self)
         self->pango_text_h = self->text_h * PANGO_SCALE;
         pango_layout_set_ellipsize(self->pl, PANGO_ELLIPSIZE_END);
     }
+    self->text_serial++;
     queue_layout_items(self);
 }
 #endif
@@ -4916,6 +7817,8 @@ static void fm_desktop_destroy(GtkObject *object)
     GdkScreen* screen;
 
     self = FM_DESKTOP(object);
+    if (active_desktop == self)
+        active_desktop = NULL;
     if(self->icon_render) /* see bug #3533958 by korzhpavel@SF */
     {
         screen = gtk_widget_get_screen((GtkWidget*)self);
@@ -4935,6 +7838,9 @@ static void fm_desktop_destroy(GtkObject *object)
             disconnect_model(self);
 
         unload_items(self);
+        hit_grid_free(self);
+        g_free(self->occupied);
+        self->occupied = NULL;
 
         g_object_unref(self->icon_render);
         self->icon_render = NULL;
@@ -4945,6 +7851,9 @@ static void fm_desktop_destroy(GtkObject *object)
 
         if(self->idle_layout)
             g_source_remove(self->idle_layout);
+        if(self->idle_relayout)
+            g_source_remove(self->idle_relayout);
+        cancel_update_rubberbanding(self);
 
         g_signal_handlers_disconnect_by_func(self->dnd_src, on_dnd_src_data_get, self);
         g_object_unref(self->dnd_src);
@@ -4968,7 +7877,13 @@ static void fm_desktop_destroy(GtkObject *object)
         g_free(self->conf.folder);
     }
 
-    _clear_bg_cache(self);
+    _bg_job_cancel(self);
+    _prefetch_cancel(self);
+    _slideshow_stop(self);
+    _unref_wallpaper_file(self->wallpaper_file);
+    self->wallpaper_file = NULL;
+    _unshow_bg_cache(self);
+    _trim_bg_cache();
 
     /* cancel any pending search timeout */
     if (G_UNLIKELY(self->search_timeout_id))
@@ -4995,8 +7910,29 @@ static void fm_desktop_destroy(GtkObject *object)
 #endif
 }
 
+static void fm_desktop_finalize(GObject *object)
+{
+    FmDesktop *self = FM_DESKTOP(object);
+
+    g_ptr_array_free(self->items, TRUE);
+    g_ptr_array_free(self->nav_items[0], TRUE);
+    g_ptr_array_free(self->nav_items[1], TRUE);
+    g_ptr_array_free(self->search_items, TRUE);
+    g_hash_table_destroy(self->positions);
+    g_free(self->saved_conf);
+    G_OBJECT_CLASS(fm_desktop_parent_class)->finalize(object);
+}
+
 static void fm_desktop_init(FmDesktop *self)
 {
+    self->items = g_ptr_array_new();
+    self->index_dirty_from = G_MAXUINT;
+    self->nav_items[0] = g_ptr_array_new();
+    self->nav_items[1] = g_ptr_array_new();
+    self->nav_dirty = TRUE;
+    self->search_items = g_ptr_array_new();
+    self->positions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, item_pos_free);
+    self->search_dirty = TRUE;
 #if GTK_CHECK_VERSION(3, 0, 0)
     self->css = gtk_css_provider_new();
     gtk_style_context_add_provider(gtk_widget_get_style_context((GtkWidget*)self),
@@ -5208,7 +8144,11 @@ static void fm_desktop_class_init(FmDesktopClass *klass)
     widget_class->motion_notify_event = on_motion_notify;
     widget_class->leave_notify_event = on_leave_notify;
     widget_class->key_press_event = on_key_press;
-    /* widget_class->style_set = on_style_set; */
+#if GTK_CHECK_VERSION(3, 0, 0)
+    widget_class->style_updated = on_style_updated;
+#else
+    widget_class->style_set = on_style_set;
+#endif
     widget_class->direction_changed = on_direction_changed;
     widget_class->realize = on_realize;
     widget_class->focus_in_event = on_focus_in;
@@ -5242,6 +8182,7 @@ static void fm_desktop_class_init(FmDesktopClass *klass)
     object_class->constructor = fm_desktop_constructor;
     object_class->set_property = fm_desktop_set_property;
     object_class->get_property = fm_desktop_get_property;
+    object_class->finalize = fm_desktop_finalize;
 
     g_object_class_install_property(object_class, PROP_MONITOR,
         g_param_spec_int("monitor", "Monitor",
@@ -5282,7 +8223,10 @@ static void _set_sort(FmFolderView* fv, GtkSortType type, FmFolderModelViewCol b
     desktop->conf.desktop_sort_type = type;
     desktop->conf.desktop_sort_by = by;
     pcmanfm_save_config(FALSE);
-    if (desktop->model)
+    /* other desktops which share the model keep their order */
+    if (desktop->model && is_model_shared(desktop, n_screens))
+        reconnect_model(desktop);
+    else if (desktop->model)
         gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(desktop->model),
                                              by, type);
 }
@@ -5328,22 +8272,15 @@ static FmFolderModel* _get_model(FmFolderView* fv)
 static gint _count_selected_files(FmFolderView* fv)
 {
     FmDesktop* desktop = FM_DESKTOP(fv);
-    GtkTreeModel* model;
-    GtkTreeIter it;
+    guint i;
     gint n = 0;
 
-    if (!desktop->model)
-        return 0;
-    model = GTK_TREE_MODEL(desktop->model);
-    if(!gtk_tree_model_get_iter_first(model, &it))
-        return 0;
-    do
+    for(i = 0; i < desktop->items->len; i++)
     {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(desktop->model, &it);
+        FmDesktopItem* item = g_ptr_array_index(desktop->items, i);
         if(item->is_selected)
             n++;
     }
-    while(gtk_tree_model_iter_next(model, &it));
     return n;
 }
 
@@ -5351,17 +8288,11 @@ static FmFileInfoList* _dup_selected_files(FmFolderView* fv)
 {
     FmDesktop* desktop = FM_DESKTOP(fv);
     FmFileInfoList* files = NULL;
-    GtkTreeModel* model;
-    GtkTreeIter it;
+    guint i;
 
-    if (!desktop->model)
-        return NULL;
-    model = GTK_TREE_MODEL(desktop->model);
-    if(!gtk_tree_model_get_iter_first(model, &it))
-        return NULL;
-    do
+    for(i = 0; i < desktop->items->len; i++)
     {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(desktop->model, &it);
+        FmDesktopItem* item = g_ptr_array_index(desktop->items, i);
         if(item->is_selected)
         {
             if(!files)
@@ -5369,7 +8300,6 @@ static FmFileInfoList* _dup_selected_files(FmFolderView* fv)
             fm_file_info_list_push_tail(files, item->fi);
         }
     }
-    while(gtk_tree_model_iter_next(model, &it));
     return files;
 }
 
@@ -5377,17 +8307,11 @@ static FmPathList* _dup_selected_file_paths(FmFolderView* fv)
 {
     FmDesktop* desktop = FM_DESKTOP(fv);
     FmPathList* files = NULL;
-    GtkTreeModel* model;
-    GtkTreeIter it;
+    guint i;
 
-    if (!desktop->model)
-        return NULL;
-    model = GTK_TREE_MODEL(desktop->model);
-    if(!gtk_tree_model_get_iter_first(model, &it))
-        return NULL;
-    do
+    for(i = 0; i < desktop->items->len; i++)
     {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(desktop->model, &it);
+        FmDesktopItem* item = g_ptr_array_index(desktop->items, i);
         if(item->is_selected)
         {
             if(!files)
@@ -5395,24 +8319,17 @@ static FmPathList* _dup_selected_file_paths(FmFolderView* fv)
             fm_path_list_push_tail(files, fm_file_info_get_path(item->fi));
         }
     }
-    while(gtk_tree_model_iter_next(model, &it));
     return files;
 }
 
 static void _select_all(FmFolderView* fv)
 {
     FmDesktop* desktop = FM_DESKTOP(fv);
-    GtkTreeIter it;
-    GtkTreeModel* model;
+    guint i;
 
-    if (!desktop->model)
-        return;
-    model = GTK_TREE_MODEL(desktop->model);
-    if(!gtk_tree_model_get_iter_first(model, &it))
-        return;
-    do
+    for(i = 0; i < desktop->items->len; i++)
     {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(desktop->model, &it);
+        FmDesktopItem* item = g_ptr_array_index(desktop->items, i);
         if(!item->is_selected)
         {
             item->is_selected = TRUE;
@@ -5420,23 +8337,16 @@ static void _select_all(FmFolderView* fv)
             fm_desktop_item_selected_changed(desktop, item);
         }
     }
-    while(gtk_tree_model_iter_next(model, &it));
 }
 
 static void _unselect_all(FmFolderView* fv)
 {
     FmDesktop* desktop = FM_DESKTOP(fv);
-    GtkTreeIter it;
-    GtkTreeModel* model;
+    guint i;
 
-    if (!desktop->model)
-        return;
-    model = GTK_TREE_MODEL(desktop->model);
-    if(!gtk_tree_model_get_iter_first(model, &it))
-        return;
-    do
+    for(i = 0; i < desktop->items->len; i++)
     {
-        FmDesktopItem* item = fm_folder_model_get_item_userdata(desktop->model, &it);
+        FmDesktopItem* item = g_ptr_array_index(desktop->items, i);
         if(item->is_selected)
         {
             item->is_selected = FALSE;
@@ -5444,7 +8354,6 @@ static void _unselect_all(FmFolderView* fv)
             fm_desktop_item_selected_changed(desktop, item);
         }
     }
-    while(gtk_tree_model_iter_next(model, &it));
 }
 
 static void _select_invert(FmFolderView* fv)
@@ -5596,6 +8505,7 @@ static void on_fg_color_set(GtkColorButton *btn, FmDesktop *desktop)
     if (!gdk_color_equal(&desktop->conf.desktop_fg, &new_val))
     {
         desktop->conf.desktop_fg = new_val;
+        desktop->render_serial++;
         queue_config_save(desktop);
         gtk_widget_queue_draw(GTK_WIDGET(desktop));
     }
@@ -5609,6 +8519,7 @@ static void on_shadow_color_set(GtkColorButton *btn, FmDesktop *desktop)
     if (!gdk_color_equal(&desktop->conf.desktop_shadow, &new_val))
     {
         desktop->conf.desktop_shadow = new_val;
+        desktop->render_serial++;
         queue_config_save(desktop);
         gtk_widget_queue_draw(GTK_WIDGET(desktop));
     }
@@ -5645,6 +8556,7 @@ static void on_desktop_font_set(GtkFontButton* btn, FmDesktop *desktop)
 
             pango_context_set_font_description(pc, font_desc);
             pango_layout_context_changed(desktop->pl);
+            desktop->text_serial++;
             gtk_widget_queue_resize(GTK_WIDGET(desktop));
             pango_font_description_free(font_desc);
         }
@@ -5666,7 +8578,9 @@ static void on_show_documents_toggled(GtkToggleButton* btn, FmDesktop *desktop)
     {
         desktop->conf.show_documents = new_val;
         queue_config_save(desktop);
-        if (documents && documents->fi && desktop->model)
+        if (desktop->model && is_model_shared(desktop, n_screens))
+            reconnect_model(desktop);
+        else if (documents && documents->fi && desktop->model)
         {
             if (new_val)
                 fm_folder_model_extra_file_add(desktop->model, documents->fi,
@@ -5685,7 +8599,9 @@ static void on_show_trash_toggled(GtkToggleButton* btn, FmDesktop *desktop)
     {
         desktop->conf.show_trash = new_val;
         queue_config_save(desktop);
-        if (trash_can && trash_can->fi && desktop->model)
+        if (desktop->model && is_model_shared(desktop, n_screens))
+            reconnect_model(desktop);
+        else if (trash_can && trash_can->fi && desktop->model)
         {
             if (new_val)
                 fm_folder_model_extra_file_add(desktop->model, trash_can->fi,
@@ -5705,7 +8621,9 @@ static void on_show_mounts_toggled(GtkToggleButton* btn, FmDesktop *desktop)
     {
         desktop->conf.show_mounts = new_val;
         queue_config_save(desktop);
-        if (desktop->model) for (msl = mounts; msl; msl = msl->next)
+        if (desktop->model && is_model_shared(desktop, n_screens))
+            reconnect_model(desktop);
+        else if (desktop->model) for (msl = mounts; msl; msl = msl->next)
         {
             FmDesktopExtraItem *mount = msl->data;
             if (new_val)
@@ -5975,7 +8893,7 @@ void fm_desktop_manager_init(gint on_screen)
     n_screens = 0;
     for(i = 0; i < n_scr; i++)
         n_screens += gdk_screen_get_n_monitors(gdk_display_get_screen(gdpy, i));
-    desktops = g_new(FmDesktop*, n_screens);
+    desktops = g_new0(FmDesktop*, n_screens);
     for(scr = 0, i = 0; scr < n_scr; scr++)
     {
         GdkScreen* screen = gdk_display_get_screen(gdpy, scr);
@@ -6086,6 +9004,8 @@ void fm_desktop_manager_finalize()
         gtk_widget_destroy(GTK_WIDGET(desktops[i]));
     }
     g_free(desktops);
+    /* wallpaper_files are freed when the last job using them is finished */
+    _clear_bg_cache();
     n_screens = 0;
     g_object_unref(win_group);
     win_group = NULL;
@@ -6103,6 +9023,23 @@ void fm_desktop_manager_finalize()
     }
 
 #if FM_CHECK_VERSION(1, 2, 0)
+    if (extra_items_idle)
+    {
+        g_source_remove(extra_items_idle);
+        extra_items_idle = 0;
+    }
+    while (extra_items_added)
+    {
+        /* documents and trash can are freed below */
+        if (((FmDesktopExtraItem *)extra_items_added->data)->mount)
+            _free_extra_item(extra_items_added->data);
+        extra_items_added = g_slist_delete_link(extra_items_added, extra_items_added);
+    }
+    while (extra_items_removed)
+    {
+        g_object_unref(extra_items_removed->data);
+        extra_items_removed = g_slist_delete_link(extra_items_removed, extra_items_removed);
+    }
     if (G_LIKELY(documents))
     {
         _free_extra_item(documents);
@@ -6112,6 +9049,18 @@ void fm_desktop_manager_finalize()
     {
         g_signal_handlers_disconnect_by_func(trash_monitor, on_trash_changed, trash_can);
         g_object_unref(trash_monitor);
+        if (trash_update_timeout)
+        {
+            g_source_remove(trash_update_timeout);
+            trash_update_timeout = 0;
+        }
+        if (trash_query)
+        {
+            g_cancellable_cancel(trash_query);
+            g_object_unref(trash_query);
+            trash_query = NULL;
+        }
+        trash_query_again = FALSE;
         _free_extra_item(trash_can);
         trash_can = NULL;
     }
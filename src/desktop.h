@@ -45,12 +45,19 @@ typedef struct _FmDesktop           FmDesktop;
 typedef struct _FmDesktopClass      FmDesktopClass;
 typedef struct _FmDesktopItem       FmDesktopItem;
 typedef struct _FmBackgroundCache   FmBackgroundCache;
+typedef struct _FmBackgroundJob     FmBackgroundJob;
+typedef struct _FmWallpaperFile     FmWallpaperFile;
 
 struct _FmDesktop
 {
     GtkWindow parent;
     /*< private >*/
     PangoLayout* pl;
+    GPtrArray* items; /* FmDesktopItem in model order */
+    guint index_dirty_from; /* item->index is outdated from here, see items_renumber() */
+    GPtrArray* nav_items[2]; /* shown items sorted by x and by y, see get_nearest_item() */
+    guint text_serial; /* changed each time item labels need to be reshaped */
+    guint render_serial; /* changed each time item colors are changed */
     FmCellRendererPixbuf* icon_render;
     GList* fixed_items;
     guint xpad;
@@ -65,18 +72,42 @@ struct _FmDesktop
     guint cell_w;
     guint cell_h;
     GdkRectangle working_area;
+    GSList** hit_grid; /* buckets of items for hit testing */
+    guint hit_grid_cols;
+    guint hit_grid_rows;
+    guint8* occupied; /* bitset of layout cells taken by fixed items */
+    gint occupied_x; /* origin of the layout cells */
+    gint occupied_y;
+    guint occupied_cols;
+    guint occupied_rows;
     FmDesktopItem* focus;
     FmDesktopItem* drop_hilight;
     FmDesktopItem* hover_item;
     gint rubber_bending_x;
     gint rubber_bending_y;
+    gint rubber_bending_new_x; /* pointer position for the next frame */
+    gint rubber_bending_new_y;
+    guint rubber_bending_update; /* tick callback or idle source */
     gint drag_start_x;
     gint drag_start_y;
     gboolean rubber_bending : 1;
     gboolean forward_pending : 1;
     gboolean dragging : 1;
     gboolean layout_pending : 1;
+    gboolean occupied_dirty : 1;
+    gboolean layout_valid : 1; /* all items are placed, see layout_x, layout_y */
+    gboolean layout_unordered : 1; /* some items are placed out of model order */
+    gboolean more_reserved : 1; /* more_rect is not available for items */
+    gboolean nav_dirty : 1; /* nav_items should be sorted again */
     guint idle_layout;
+    gint layout_x; /* place for the next auto-positioned item */
+    gint layout_y;
+    guint idle_relayout;
+    gint relayout_from; /* index of first item to reflow */
+    gint relayout_x;
+    gint relayout_y;
+    guint n_hidden; /* number of items which don't fit into the screen */
+    GdkRectangle more_rect; /* place of the "N more items" label */
     FmDndSrc* dnd_src;
     FmDndDest* dnd_dest;
     guint single_click_timeout_handler;
@@ -84,7 +115,20 @@ struct _FmDesktop
     FmFolderModel* model;
     guint cur_desktop;
     gint monitor;
-    FmBackgroundCache *cache;
+    FmBackgroundCache *bg_shown; /* wallpaper shown now */
+    FmBackgroundJob *bg_job; /* wallpaper being composed currently */
+    FmBackgroundJob *bg_wait; /* the same wallpaper composed for another desktop */
+    FmBackgroundJob *prefetch_job; /* wallpaper for another workspace */
+    FmWallpaperFile *prefetch_wait; /* candidate for prefetch not queried yet */
+    FmWallpaperFile *wallpaper_file; /* current wallpaper, file or directory */
+    guint idle_prefetch;
+    guint prefetch_next; /* next candidate for prefetching */
+    guint recent_desktops[4]; /* recently shown workspaces, last first */
+    guint n_recent;
+    char *slideshow; /* directory shown as slideshow or NULL */
+    guint slide; /* number of slide shown, the same for all workspaces */
+    guint slide_timer;
+    int slide_interval; /* interval of the running slide_timer */
 #if GTK_CHECK_VERSION(3, 0, 0)
     GtkCssProvider *css;
 #endif
@@ -92,10 +136,16 @@ struct _FmDesktop
     GtkWidget *search_window;
     GtkWidget *search_entry;
     gboolean search_imcontext_changed : 1;
+    gboolean search_dirty : 1; /* search_items should be sorted again */
     guint search_entry_changed_id;
     guint search_timeout_id;
+    GPtrArray *search_items; /* items sorted by normalized name */
     /* desktop settings for this monitor */
     FmDesktopConfig conf;
+    GHashTable *positions; /* basename -> saved position of fixed item */
+    char *saved_conf; /* desktop config as it is in the .conf file */
+    guint n_pos_log; /* records in the positions log */
+    gboolean positions_loaded : 1;
 #ifdef HAVE_WAYLAND
     GtkWindow *wallpaper_window;
 #endif
@@ -72,6 +72,7 @@ static gint show_pref = -1;
 static gboolean desktop_pref = FALSE;
 static char* set_wallpaper = NULL;
 static char* wallpaper_mode = NULL;
+static gint slideshow_interval = -1;
 static gboolean new_win = FALSE;
 #if FM_CHECK_VERSION(1, 0, 2)
 static gboolean find_files = FALSE;
@@ -93,9 +94,10 @@ static GOptionEntry opt_entries[] =
     { "desktop-off", '\0', 0, G_OPTION_ARG_NONE, &desktop_off, N_("Turn off desktop manager if it's running"), NULL },
     { "desktop-pref", '\0', 0, G_OPTION_ARG_NONE, &desktop_pref, N_("Open desktop preference dialog"), NULL },
     { "one-screen", '\0', 0, G_OPTION_ARG_NONE, &one_screen, N_("Use --desktop option only for one screen"), NULL },
-    { "set-wallpaper", 'w', 0, G_OPTION_ARG_FILENAME, &set_wallpaper, N_("Set desktop wallpaper from image FILE"), N_("FILE") },
+    { "set-wallpaper", 'w', 0, G_OPTION_ARG_FILENAME, &set_wallpaper, N_("Set desktop wallpaper from image FILE, or slideshow of images in directory FILE"), N_("FILE") },
                     /* don't translate list of modes in description, please */
     { "wallpaper-mode", '\0', 0, G_OPTION_ARG_STRING, &wallpaper_mode, N_("Set mode of desktop wallpaper. MODE=(color|stretch|fit|crop|center|tile|screen)"), N_("MODE") },
+    { "slideshow-interval", '\0', 0, G_OPTION_ARG_INT, &slideshow_interval, N_("Change wallpaper slideshow image each N seconds"), N_("N") },
     { "show-pref", '\0', 0, G_OPTION_ARG_INT, &show_pref, N_("Open Preferences dialog on the page N"), N_("N") },
     { "new-win", 'n', 0, G_OPTION_ARG_NONE, &new_win, N_("Open new window"), NULL },
 #if FM_CHECK_VERSION(1, 0, 2)
@@ -332,6 +334,7 @@ static gboolean reset_options(void)
     set_wallpaper = NULL;
     g_free(wallpaper_mode);
     wallpaper_mode = NULL;
+    slideshow_interval = -1;
     show_pref = -1;
     new_win = FALSE;
 #if FM_CHECK_VERSION(1, 0, 2)
@@ -400,7 +403,7 @@ gboolean pcmanfm_run(gint screen_num)
         else if(desktop == NULL)
         {
             /* ignore desktop-oriented commands if no desktop support */
-            if (desktop_pref || wallpaper_mode || set_wallpaper)
+            if (desktop_pref || wallpaper_mode || set_wallpaper || slideshow_interval >= 0)
             {
                 /* FIXME: add "on this X screen/monitor" into diagnostics */
                 fm_show_error(NULL, NULL, _("Desktop manager is not active."));
@@ -413,14 +416,16 @@ gboolean pcmanfm_run(gint screen_num)
             fm_desktop_preference(NULL, desktop);
             return reset_options();
         }
-        else if(wallpaper_mode || set_wallpaper)
+        else if(wallpaper_mode || set_wallpaper || slideshow_interval >= 0)
         {
             gboolean wallpaper_changed = FALSE;
             if(set_wallpaper) /* a new wallpaper is assigned */
             {
                 /* g_debug("\'%s\'", set_wallpaper); */
-                /* Make sure this is a support image file. */
-                if(gdk_pixbuf_get_file_info(set_wallpaper, NULL, NULL))
+                /* Make sure this is a support image file or a directory
+                   of images for slideshow. */
+                if(g_file_test(set_wallpaper, G_FILE_TEST_IS_DIR) ||
+                   gdk_pixbuf_get_file_info(set_wallpaper, NULL, NULL))
                 {
                     if(desktop->conf.wallpaper)
                         g_free(desktop->conf.wallpaper);
@@ -448,6 +453,13 @@ gboolean pcmanfm_run(gint screen_num)
                 }
             }
 
+            if(slideshow_interval >= 0
+               && slideshow_interval != desktop->conf.slideshow_interval)
+            {
+                desktop->conf.slideshow_interval = slideshow_interval;
+                wallpaper_changed = TRUE;
+            }
+
             if(wallpaper_changed)
                 fm_desktop_wallpaper_changed(desktop);
 
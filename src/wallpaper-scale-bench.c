@@ -0,0 +1,135 @@
+/*
+ *      wallpaper-scale-bench.c
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+/* times fm_wallpaper_scale() with each set of kernels available:
+       wallpaper-scale-bench [src_w src_h dest_w dest_h [runs]] */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "wallpaper-scale.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *mode_names[] = { "C", "SSE2", "AVX2" };
+
+static GdkPixbuf *create_image(int w, int h, gboolean has_alpha)
+{
+    GdkPixbuf *pix = gdk_pixbuf_new(GDK_COLORSPACE_RGB, has_alpha, 8, w, h);
+    int n_channels, stride, x, y;
+    guchar *pixels;
+    guint32 seed = 1;
+
+    if(!pix)
+        return NULL;
+    n_channels = gdk_pixbuf_get_n_channels(pix);
+    stride = gdk_pixbuf_get_rowstride(pix);
+    pixels = gdk_pixbuf_get_pixels(pix);
+    /* some noise over gradients so that no kernel gets a trivial input */
+    for(y = 0; y < h; y++)
+    {
+        guchar *p = pixels + (gsize)y * stride;
+
+        for(x = 0; x < w * n_channels; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            p[x] = (guchar)((x / n_channels * 255 / w + y * 255 / h) / 2
+                            + ((seed >> 16) & 0x3f));
+        }
+    }
+    return pix;
+}
+
+static void run_bench(GdkPixbuf *src, int dest_w, int dest_h, int runs)
+{
+    FmWallpaperScaleMode mode;
+    GTimer *timer = g_timer_new();
+
+    for(mode = FM_WALLPAPER_SCALE_C; mode <= FM_WALLPAPER_SCALE_AVX2; mode++)
+    {
+        double best = 0.0;
+        int i;
+
+        if(!fm_wallpaper_scale_set_mode(mode))
+        {
+            printf("  %-5s not supported\n", mode_names[mode]);
+            continue;
+        }
+        for(i = 0; i < runs; i++)
+        {
+            GdkPixbuf *dest;
+            double t;
+
+            g_timer_start(timer);
+            dest = fm_wallpaper_scale(src, dest_w, dest_h);
+            t = g_timer_elapsed(timer, NULL);
+            if(dest)
+                g_object_unref(dest);
+            if(i == 0 || t < best)
+                best = t;
+        }
+        printf("  %-5s %8.1f ms\n", mode_names[mode], best * 1000.0);
+    }
+    fm_wallpaper_scale_set_mode(FM_WALLPAPER_SCALE_AUTO);
+    g_timer_destroy(timer);
+}
+
+int main(int argc, char **argv)
+{
+    int src_w = 6000, src_h = 4000, dest_w = 3840, dest_h = 2160, runs = 5;
+    GdkPixbuf *src;
+    int alpha;
+
+    if(argc >= 5)
+    {
+        src_w = atoi(argv[1]);
+        src_h = atoi(argv[2]);
+        dest_w = atoi(argv[3]);
+        dest_h = atoi(argv[4]);
+    }
+    if(argc >= 6)
+        runs = atoi(argv[5]);
+    if(src_w <= 0 || src_h <= 0 || dest_w <= 0 || dest_h <= 0 || runs <= 0)
+    {
+        fprintf(stderr, "usage: %s [src_w src_h dest_w dest_h [runs]]\n", argv[0]);
+        return 1;
+    }
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+    g_type_init();
+#endif
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_init(NULL);
+#endif
+    for(alpha = 0; alpha <= 1; alpha++)
+    {
+        src = create_image(src_w, src_h, alpha);
+        if(!src)
+        {
+            fprintf(stderr, "cannot allocate %dx%d image\n", src_w, src_h);
+            return 1;
+        }
+        printf("%dx%d %s -> %dx%d, best of %d:\n", src_w, src_h,
+               alpha ? "RGBA" : "RGB", dest_w, dest_h, runs);
+        run_bench(src, dest_w, dest_h, runs);
+        g_object_unref(src);
+    }
+    return 0;
+}
@@ -0,0 +1,423 @@
+/*
+ *      wallpaper-scale.c
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "wallpaper-scale.h"
+
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#ifdef HAVE_FUNC_ATTRIBUTE_TARGET
+#include <immintrin.h>
+#endif
+
+/* the image is split into bands of rows which are scaled in parallel */
+#define WS_MAX_THREADS 8
+#define WS_MIN_BAND_HEIGHT 64
+
+/* contribution of source pixels into one destination pixel along one axis */
+typedef struct
+{
+    int first; /* first source pixel */
+    int n; /* number of source pixels */
+    const float *weights;
+} WsContrib;
+
+typedef struct
+{
+    const guchar *src;
+    int src_stride;
+    guchar *dest;
+    int dest_stride;
+    int n_channels;
+    int dest_w;
+    const WsContrib *xc;
+    const WsContrib *yc;
+    int y1, y2; /* band of destination rows */
+} WsBand;
+
+/* acc[i] += row[i] * w */
+typedef void (*WsAccumulateFunc)(float *acc, const float *row, float w, int len);
+/* scales a row of 4-channel pixels horizontally */
+typedef void (*WsScaleRowFunc)(const guchar *src, float *dest, const WsContrib *xc, int dest_w);
+
+static WsAccumulateFunc ws_accumulate = NULL;
+static WsScaleRowFunc ws_scale_row4 = NULL;
+static FmWallpaperScaleMode ws_best_mode = FM_WALLPAPER_SCALE_C;
+
+/* area averaging: each destination pixel is an average of the source area it
+   covers, pixels covered partially on edges of the area have less weight */
+static WsContrib *ws_contribs_new(int src_len, int dest_len, float **weights)
+{
+    double scale = (double)src_len / dest_len;
+    int max_n = (int)ceil(scale) + 1;
+    WsContrib *c = g_new(WsContrib, dest_len);
+    float *w;
+    int d, i;
+
+    *weights = g_new(float, (gsize)dest_len * max_n);
+    for(d = 0; d < dest_len; d++)
+    {
+        double start = d * scale;
+        double end = start + scale;
+        int first = (int)floor(start);
+        int last = MIN((int)ceil(end), src_len) - 1;
+
+        w = *weights + (gsize)d * max_n;
+        c[d].first = first;
+        c[d].n = last - first + 1;
+        c[d].weights = w;
+        for(i = first; i <= last; i++)
+            *w++ = (float)((MIN(end, i + 1) - MAX(start, i)) / scale);
+    }
+    return c;
+}
+
+static void ws_accumulate_c(float *acc, const float *row, float w, int len)
+{
+    int i;
+
+    for(i = 0; i < len; i++)
+        acc[i] += row[i] * w;
+}
+
+/* pixels with alpha channel are premultiplied so color of transparent pixels
+   does not bleed into visible ones, see ws_scale_band() */
+static void ws_scale_row_c(const guchar *src, float *dest, const WsContrib *xc,
+                           int dest_w, int n_channels)
+{
+    int x, i, ch;
+
+    for(x = 0; x < dest_w; x++)
+    {
+        const WsContrib *c = &xc[x];
+        const guchar *p = src + c->first * n_channels;
+
+        if(n_channels == 4)
+        {
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+            for(i = 0; i < c->n; i++)
+            {
+                const guchar *px = p + i * 4;
+                float a = px[3] * c->weights[i];
+
+                sum[0] += px[0] * a;
+                sum[1] += px[1] * a;
+                sum[2] += px[2] * a;
+                sum[3] += a;
+            }
+            *dest++ = sum[0] * (1.0f / 255.0f);
+            *dest++ = sum[1] * (1.0f / 255.0f);
+            *dest++ = sum[2] * (1.0f / 255.0f);
+            *dest++ = sum[3];
+            continue;
+        }
+        for(ch = 0; ch < n_channels; ch++)
+        {
+            float sum = 0.0f;
+
+            for(i = 0; i < c->n; i++)
+                sum += p[i * n_channels + ch] * c->weights[i];
+            *dest++ = sum;
+        }
+    }
+}
+
+#ifdef HAVE_FUNC_ATTRIBUTE_TARGET
+__attribute__((target("sse2")))
+static void ws_accumulate_sse2(float *acc, const float *row, float w, int len)
+{
+    __m128 vw = _mm_set1_ps(w);
+    int i;
+
+    for(i = 0; i + 4 <= len; i += 4)
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                          _mm_mul_ps(_mm_loadu_ps(row + i), vw)));
+    for(; i < len; i++)
+        acc[i] += row[i] * w;
+}
+
+__attribute__((target("avx2")))
+static void ws_accumulate_avx2(float *acc, const float *row, float w, int len)
+{
+    __m256 vw = _mm256_set1_ps(w);
+    int i;
+
+    for(i = 0; i + 8 <= len; i += 8)
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                                _mm256_mul_ps(_mm256_loadu_ps(row + i), vw)));
+    for(; i < len; i++)
+        acc[i] += row[i] * w;
+}
+
+/* all four channels of a pixel are processed at once, color is premultiplied
+   the same way as in ws_scale_row_c() */
+__attribute__((target("sse2")))
+static void ws_scale_row4_sse2(const guchar *src, float *dest, const WsContrib *xc,
+                               int dest_w)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x, i;
+
+    for(x = 0; x < dest_w; x++)
+    {
+        const WsContrib *c = &xc[x];
+        const guchar *p = src + c->first * 4;
+        __m128 sum = _mm_setzero_ps();
+
+        for(i = 0; i < c->n; i++)
+        {
+            __m128i px;
+            int v;
+            float k = p[i * 4 + 3] * c->weights[i] * (1.0f / 255.0f);
+
+            memcpy(&v, p + i * 4, 4);
+            px = _mm_cvtsi32_si128(v);
+            px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(px, zero), zero);
+            /* alpha is weighted as is, color is weighted by alpha too */
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_cvtepi32_ps(px),
+                                             _mm_set_ps(c->weights[i], k, k, k)));
+        }
+        _mm_storeu_ps(dest + x * 4, sum);
+    }
+}
+#endif
+
+static void ws_set_kernels(FmWallpaperScaleMode mode)
+{
+    ws_accumulate = ws_accumulate_c;
+    ws_scale_row4 = NULL;
+#ifdef HAVE_FUNC_ATTRIBUTE_TARGET
+    if(mode >= FM_WALLPAPER_SCALE_SSE2)
+    {
+        ws_accumulate = ws_accumulate_sse2;
+        ws_scale_row4 = ws_scale_row4_sse2;
+    }
+    if(mode >= FM_WALLPAPER_SCALE_AVX2)
+        ws_accumulate = ws_accumulate_avx2;
+#endif
+}
+
+/* selects the best kernels for this CPU */
+static void ws_init(void)
+{
+    static gsize initialized = 0;
+
+    if(g_once_init_enter(&initialized))
+    {
+#ifdef HAVE_FUNC_ATTRIBUTE_TARGET
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+            ws_best_mode = FM_WALLPAPER_SCALE_AVX2;
+        else if(__builtin_cpu_supports("sse2"))
+            ws_best_mode = FM_WALLPAPER_SCALE_SSE2;
+#endif
+        ws_set_kernels(ws_best_mode);
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+/**
+ * fm_wallpaper_scale_set_mode
+ * @mode: kernels to use
+ *
+ * Forces fm_wallpaper_scale() to use kernels for @mode, mostly useful for
+ * benchmarks. %FM_WALLPAPER_SCALE_AUTO selects the best kernels for the CPU.
+ * Should not be called while some scaling is in progress.
+ *
+ * Returns: %FALSE if @mode is not supported by this build or CPU.
+ */
+gboolean fm_wallpaper_scale_set_mode(FmWallpaperScaleMode mode)
+{
+    ws_init();
+    if(mode == FM_WALLPAPER_SCALE_AUTO)
+        mode = ws_best_mode;
+    else if(mode > ws_best_mode)
+        return FALSE;
+    ws_set_kernels(mode);
+    return TRUE;
+}
+
+static int ws_get_n_processors(void)
+{
+#if GLIB_CHECK_VERSION(2, 36, 0)
+    return g_get_num_processors();
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+#else
+    return 1;
+#endif
+}
+
+static gpointer ws_scale_band(gpointer data)
+{
+    WsBand *b = data;
+    int len = b->dest_w * b->n_channels;
+    float *row = g_new(float, len);
+    float *last_row = g_new(float, len);
+    float *acc = g_new(float, len);
+    float *tmp;
+    int last = -1; /* source row in last_row */
+    int y, i, j;
+
+    for(y = b->y1; y < b->y2; y++)
+    {
+        const WsContrib *c = &b->yc[y];
+        guchar *out = b->dest + (gsize)y * b->dest_stride;
+
+        memset(acc, 0, len * sizeof(float));
+        for(i = 0; i < c->n; i++)
+        {
+            int r = c->first + i;
+            const guchar *in = b->src + (gsize)r * b->src_stride;
+
+            /* the last source row is usually the first one for the next row */
+            if(r == last)
+            {
+                ws_accumulate(acc, last_row, c->weights[i], len);
+                continue;
+            }
+            if(b->n_channels == 4 && ws_scale_row4)
+                ws_scale_row4(in, row, b->xc, b->dest_w);
+            else
+                ws_scale_row_c(in, row, b->xc, b->dest_w, b->n_channels);
+            ws_accumulate(acc, row, c->weights[i], len);
+            if(i == c->n - 1)
+            {
+                tmp = last_row;
+                last_row = row;
+                row = tmp;
+                last = r;
+            }
+        }
+        if(b->n_channels == 4)
+        {
+            /* undo premultiplication */
+            for(j = 0; j < len; j += 4)
+            {
+                float a = acc[j + 3];
+                float k = (a > 0.0f) ? 255.0f / a : 0.0f;
+                int ch;
+
+                for(ch = 0; ch < 3; ch++)
+                {
+                    float v = acc[j + ch] * k + 0.5f;
+
+                    out[j + ch] = (v <= 0.0f) ? 0 : (v >= 255.0f) ? 255 : (guchar)v;
+                }
+                a += 0.5f;
+                out[j + 3] = (a <= 0.0f) ? 0 : (a >= 255.0f) ? 255 : (guchar)a;
+            }
+        }
+        else
+        {
+            for(j = 0; j < len; j++)
+            {
+                float v = acc[j] + 0.5f;
+
+                out[j] = (v <= 0.0f) ? 0 : (v >= 255.0f) ? 255 : (guchar)v;
+            }
+        }
+    }
+    g_free(acc);
+    g_free(last_row);
+    g_free(row);
+    return NULL;
+}
+
+/**
+ * fm_wallpaper_scale
+ * @src: source image
+ * @dest_w: width of new image
+ * @dest_h: height of new image
+ *
+ * Creates a scaled copy of @src. Images are reduced using area averaging,
+ * spread over available CPU cores, enlarging is done by GdkPixbuf.
+ * This function is thread-safe.
+ *
+ * Returns: (transfer full): new image or %NULL if out of memory.
+ */
+GdkPixbuf *fm_wallpaper_scale(GdkPixbuf *src, int dest_w, int dest_h)
+{
+    int src_w = gdk_pixbuf_get_width(src);
+    int src_h = gdk_pixbuf_get_height(src);
+    GdkPixbuf *dest;
+    WsContrib *xc, *yc;
+    float *xw, *yw;
+    WsBand *bands;
+    GThread **threads;
+    int n_threads, i;
+
+    if(dest_w > src_w || dest_h > src_h
+       || gdk_pixbuf_get_bits_per_sample(src) != 8
+       || gdk_pixbuf_get_colorspace(src) != GDK_COLORSPACE_RGB)
+        return gdk_pixbuf_scale_simple(src, dest_w, dest_h, GDK_INTERP_BILINEAR);
+    dest = gdk_pixbuf_new(GDK_COLORSPACE_RGB, gdk_pixbuf_get_has_alpha(src), 8,
+                          dest_w, dest_h);
+    if(!dest)
+        return NULL;
+    ws_init();
+    xc = ws_contribs_new(src_w, dest_w, &xw);
+    yc = ws_contribs_new(src_h, dest_h, &yw);
+    n_threads = CLAMP(MIN(ws_get_n_processors(), dest_h / WS_MIN_BAND_HEIGHT),
+                      1, WS_MAX_THREADS);
+    bands = g_new(WsBand, n_threads);
+    threads = g_new0(GThread*, n_threads);
+    for(i = 0; i < n_threads; i++)
+    {
+        bands[i].src = gdk_pixbuf_get_pixels(src);
+        bands[i].src_stride = gdk_pixbuf_get_rowstride(src);
+        bands[i].dest = gdk_pixbuf_get_pixels(dest);
+        bands[i].dest_stride = gdk_pixbuf_get_rowstride(dest);
+        bands[i].n_channels = gdk_pixbuf_get_n_channels(src);
+        bands[i].dest_w = dest_w;
+        bands[i].xc = xc;
+        bands[i].yc = yc;
+        bands[i].y1 = dest_h * i / n_threads;
+        bands[i].y2 = dest_h * (i + 1) / n_threads;
+    }
+    /* the first band is done in this thread */
+    for(i = 1; i < n_threads; i++)
+    {
+#if GLIB_CHECK_VERSION(2, 32, 0)
+        threads[i] = g_thread_try_new("wallpaper-scale", ws_scale_band, &bands[i], NULL);
+#else
+        threads[i] = g_thread_create(ws_scale_band, &bands[i], TRUE, NULL);
+#endif
+        if(!threads[i])
+            ws_scale_band(&bands[i]);
+    }
+    ws_scale_band(&bands[0]);
+    for(i = 1; i < n_threads; i++)
+        if(threads[i])
+            g_thread_join(threads[i]);
+    g_free(threads);
+    g_free(bands);
+    g_free(xc);
+    g_free(xw);
+    g_free(yc);
+    g_free(yw);
+    return dest;
+}
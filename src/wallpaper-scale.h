@@ -0,0 +1,40 @@
+/*
+ *      wallpaper-scale.h
+ *
+ *      This program is free software; you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 2 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program; if not, write to the Free Software
+ *      Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *      MA 02110-1301, USA.
+ */
+
+#ifndef __WALLPAPER_SCALE_H__
+#define __WALLPAPER_SCALE_H__
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    FM_WALLPAPER_SCALE_AUTO = -1,
+    FM_WALLPAPER_SCALE_C,
+    FM_WALLPAPER_SCALE_SSE2,
+    FM_WALLPAPER_SCALE_AVX2
+} FmWallpaperScaleMode;
+
+GdkPixbuf *fm_wallpaper_scale(GdkPixbuf *src, int dest_w, int dest_h);
+gboolean fm_wallpaper_scale_set_mode(FmWallpaperScaleMode mode);
+
+G_END_DECLS
+
+#endif /* __WALLPAPER_SCALE_H__ */